@@ -0,0 +1,1084 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef COLOR_DEDUP_H
+#define COLOR_DEDUP_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include <QFloat16>
+#include <QtAlgorithms>
+
+#include "color_table.h"
+#include "parallel_funcs.h"
+#include "pixel_sampler.h"
+#include "pixelfeed.h"
+#include "plot_typedefs.h"
+
+/*
+ * Common interface of the duplicate color finders
+ *
+ * run() is blocking and meant to be called off the GUI thread; progress,
+ * skipped pixel count and cancel() are atomics so they can be used from any
+ * thread while it runs. Cancel is checked once per block of pixels.
+ */
+template<typename T>
+class ColorDedupEngine
+{
+public:
+    virtual ~ColorDedupEngine() = default;
+
+    /*
+     * Scan pixelCount pixels of numChannels samples each.
+     * When skipTransparent is set and there are 4 channels, pixels with zero alpha are skipped.
+     * With a sampler, pixelCount is its window sample count and pixels its window buffer.
+     */
+    virtual void run(const T *pixels, quint64 pixelCount, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) = 0;
+
+    // fn(const ImageRGBTyped<T> &) for every unique color, N holds the occurrence
+    virtual void forEachColor(const std::function<void(const ImageRGBTyped<T> &)> &fn) const = 0;
+
+    virtual quint64 uniqueCount() const = 0;
+
+    // free the tables
+    virtual void clear() = 0;
+
+    /*
+     * Push mode, for pixels arriving from threads the engine doesn't own (decoder callbacks).
+     * beginFeed() once with the number of feeding threads, then feed() from them, each thread
+     * index from one thread at a time, and endFeed() to merge. The sampler doesn't apply to
+     * fed pixels. Only the hash based engines can do it, see createFeedColorDedup().
+     */
+    virtual bool beginFeed(int threads, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent)
+    {
+        Q_UNUSED(threads)
+        Q_UNUSED(numChannels)
+        Q_UNUSED(chR)
+        Q_UNUSED(chG)
+        Q_UNUSED(chB)
+        Q_UNUSED(skipTransparent)
+        return false;
+    }
+
+    virtual void feed(int thread, const T *pixels, quint64 pixelCount)
+    {
+        Q_UNUSED(thread)
+        Q_UNUSED(pixels)
+        Q_UNUSED(pixelCount)
+    }
+
+    virtual void endFeed()
+    {
+    }
+
+    // when set, run() adds to the colors of the previous runs instead of starting over,
+    // so an image can be fed strip by strip. Call endAccumulate() after the last run
+    void setAccumulate(bool accumulate)
+    {
+        m_accumulate = accumulate;
+    }
+
+    // merges what the accumulated runs deferred, the colors are complete after it
+    virtual void endAccumulate()
+    {
+    }
+
+    // optional, reads the pixels the sampler picks instead of all of them
+    void setSampler(const StratifiedPixelSampler *sampler)
+    {
+        m_sampler = (sampler && sampler->isActive()) ? sampler : nullptr;
+    }
+
+    void cancel()
+    {
+        m_canceled = true;
+    }
+
+    bool isCanceled() const
+    {
+        return m_canceled.load(std::memory_order_relaxed) || (m_token && m_token->isCanceled());
+    }
+
+    // optional, progress is mirrored into the token and its cancel is honored as well
+    void setProgressToken(ProgressToken *token)
+    {
+        m_token = token;
+    }
+
+    quint64 processedPixels() const
+    {
+        return m_processed.load(std::memory_order_relaxed);
+    }
+
+    quint64 skippedPixels() const
+    {
+        return m_skipped.load(std::memory_order_relaxed);
+    }
+
+protected:
+    static constexpr quint64 progressBlock = 65536;
+
+    std::atomic<quint64> m_processed{0};
+    std::atomic<quint64> m_skipped{0};
+    std::atomic<bool> m_canceled{false};
+    ProgressToken *m_token{nullptr};
+    const StratifiedPixelSampler *m_sampler{nullptr};
+    bool m_accumulate{false};
+
+    // offset of the p-th pixel to scan, in pixels
+    inline quint64 pixelIndex(quint64 p) const
+    {
+        return m_sampler ? m_sampler->pixelIndex(p) : p;
+    }
+
+    void addProgress(quint64 n)
+    {
+        m_processed.fetch_add(n, std::memory_order_relaxed);
+        if (m_token) m_token->advance(n);
+    }
+};
+
+/*
+ * Sharded duplicate color finder
+ *
+ * The pixel buffer is split into one disjoint range per worker, and every
+ * worker routes its colors by hash into its own row of shard tables (flat
+ * FlatColorTable counters keyed on the packed channels), so nothing
+ * is shared while scanning. Afterwards every shard is merged across the workers
+ * in parallel. A color always lands on the same shard, so shards never overlap
+ * and the merge doesn't need any locking either.
+ */
+template<typename T>
+class ShardedColorDedup : public ColorDedupEngine<T>
+{
+    using ColorDedupEngine<T>::progressBlock;
+    using ColorDedupEngine<T>::m_processed;
+    using ColorDedupEngine<T>::m_skipped;
+    using ColorDedupEngine<T>::m_canceled;
+
+public:
+    typedef ColorKeyTraits<T> Traits;
+    typedef typename Traits::Key Key;
+    typedef FlatColorTable<Key, quint32> Shard;
+
+    explicit ShardedColorDedup(int workers = QThread::idealThreadCount())
+        : m_workers(std::max(1, workers))
+    {
+        while ((1 << m_shardBits) < m_workers) {
+            m_shardBits++;
+        }
+    }
+
+    void run(const T *pixels, quint64 pixelCount, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        const int workers = std::min(m_workers, suggestedWorkers(pixelCount));
+        beginFeed(workers, numChannels, chR, chG, chB, skipTransparent);
+
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 begin = workerRangeBegin(pixelCount, workers, worker);
+            const quint64 end = workerRangeEnd(pixelCount, workers, worker);
+            for (quint64 blk = begin; blk < end; blk += progressBlock) {
+                if (this->isCanceled()) break;
+                const quint64 blkEnd = std::min(end, blk + progressBlock);
+                scan<true>(worker, pixels, blk, blkEnd);
+                this->addProgress(blkEnd - blk);
+            }
+        });
+
+        endFeed();
+    }
+
+    bool beginFeed(int threads, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        if (!this->m_accumulate) {
+            m_processed = 0;
+            m_skipped = 0;
+            m_shards.clear();
+        }
+        m_local.assign(std::max(1, threads), std::vector<Shard>(1 << m_shardBits));
+        m_numChannels = numChannels;
+        m_ch[0] = chR;
+        m_ch[1] = chG;
+        m_ch[2] = chB;
+        m_checkAlpha = (numChannels == 4 && skipTransparent);
+        return true;
+    }
+
+    void feed(int thread, const T *pixels, quint64 pixelCount) override
+    {
+        if (this->isCanceled()) return;
+        scan<false>(thread, pixels, 0, pixelCount);
+        this->addProgress(pixelCount);
+    }
+
+    void endFeed() override
+    {
+        const int numShards = 1 << m_shardBits;
+        const int threads = static_cast<int>(m_local.size());
+        m_shards.resize(numShards);
+
+        const int mergeWorkers = std::min(threads, numShards);
+        parallelForWorkers(mergeWorkers, [&](int worker) {
+            for (int s = worker; s < numShards; s += mergeWorkers) {
+                Shard &merged = m_shards[s];
+                int w = 0;
+                if (merged.size() == 0) {
+                    merged = std::move(m_local[0][s]);
+                    w = 1;
+                }
+                for (; w < threads; w++) {
+                    m_local[w][s].forEach([&](const Key &key, quint32 n) {
+                        merged.findOrInsert(key, hashKey(key)) += n;
+                    });
+                    m_local[w][s].clear();
+                }
+            }
+        });
+        std::vector<std::vector<Shard>>().swap(m_local);
+    }
+
+    quint64 uniqueCount() const override
+    {
+        quint64 total = 0;
+        for (const auto &s : m_shards) {
+            total += s.size();
+        }
+        return total;
+    }
+
+    const std::vector<Shard> &shards() const
+    {
+        return m_shards;
+    }
+
+    void forEachColor(const std::function<void(const ImageRGBTyped<T> &)> &fn) const override
+    {
+        for (const auto &s : m_shards) {
+            s.forEach([&](const Key &key, quint32 n) {
+                ImageRGBTyped<T> c;
+                Traits::unpack(key, c.R, c.G, c.B);
+                c.N = n;
+                fn(c);
+            });
+        }
+    }
+
+    void clear() override
+    {
+        std::vector<Shard>().swap(m_shards);
+    }
+
+private:
+    // tables index with the low bits and tag with the top 7, so shard on bits from the middle
+    inline int shardOf(quint64 hash) const
+    {
+        return static_cast<int>((hash >> 40) & ((1u << m_shardBits) - 1));
+    }
+
+    // counts pixels [begin, end) into the tables of one thread, through the sampler when sampled
+    template<bool sampled>
+    void scan(int thread, const T *pixels, quint64 begin, quint64 end)
+    {
+        std::vector<Shard> &tables = m_local[thread];
+        quint64 skipAlpha = 0;
+        for (quint64 p = begin; p < end; p++) {
+            const T *px = pixels + ((sampled ? this->pixelIndex(p) : p) * m_numChannels);
+            if (m_checkAlpha && px[3] == T(0)) {
+                skipAlpha++;
+                continue;
+            }
+            const Key key = Traits::pack(px[m_ch[0]], px[m_ch[1]], px[m_ch[2]]);
+            const quint64 hash = hashKey(key);
+            tables[shardOf(hash)].findOrInsert(key, hash)++;
+        }
+        m_skipped.fetch_add(skipAlpha, std::memory_order_relaxed);
+    }
+
+    int m_workers{1};
+    int m_shardBits{0};
+
+    std::vector<Shard> m_shards;
+
+    // per thread tables while scanning or being fed
+    std::vector<std::vector<Shard>> m_local;
+    quint8 m_numChannels{4};
+    quint8 m_ch[3]{0, 1, 2};
+    bool m_checkAlpha{false};
+};
+
+/*
+ * Dense 8 bit RGB histogram
+ *
+ * The whole 8 bit color space is only 2^24 values, so instead of hashing every
+ * pixel bumps its own counter in a flat array. Each worker fills a partial
+ * histogram of its pixel range, then the partials are summed per key slice in
+ * parallel while an occupancy bitmap is built for the final walk.
+ *
+ * A partial costs 64 MiB, the worker count is capped by partialBudget so big
+ * machines don't blow up memory, and small images should stay on the hash
+ * tables since zeroing and reducing 16M counters is a fixed cost.
+ *
+ * The default budget is 8 partials, so counting stops scaling at 8 threads
+ * whatever the core count. That's on purpose: every extra worker costs another
+ * 64 MiB and another 16M counters to zero and reduce, and the memory isn't
+ * checked anywhere. Pass a bigger budget to trade memory for more threads.
+ *
+ * When accumulating, the partials stay alive across runs and are reduced once
+ * in endAccumulate(), so a strip only costs its own pixels. They are held for
+ * the whole image then, so only accumulatePartials of them are used.
+ */
+class DenseColorHistogram8 : public ColorDedupEngine<quint8>
+{
+public:
+    static constexpr quint64 keyCount = 1u << 24;
+    static constexpr quint64 minPixels = 1u << 22;
+    // partials kept across accumulated runs, 128 MiB
+    static constexpr quint64 accumulatePartials = 2;
+
+    static constexpr quint64 defaultPartialBudget = 512ull * 1024 * 1024;
+
+    explicit DenseColorHistogram8(quint64 partialBudget = defaultPartialBudget)
+        : m_maxPartials(std::max<quint64>(1, partialBudget / (keyCount * sizeof(quint32))))
+    {
+    }
+
+    void run(const quint8 *pixels, quint64 pixelCount, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        const bool checkAlpha = (numChannels == 4 && skipTransparent);
+        const quint64 maxPartials = m_accumulate ? std::min(m_maxPartials, accumulatePartials) : m_maxPartials;
+        const int workers = static_cast<int>(std::min<quint64>(maxPartials, suggestedWorkers(pixelCount, minPixels / 4)));
+
+        if (!m_accumulate) {
+            m_processed = 0;
+            m_skipped = 0;
+            clear();
+        }
+        m_unique = 0;
+
+        // only new partials are zeroed, the ones of earlier runs keep counting
+        if (m_partials.size() < static_cast<size_t>(workers)) {
+            m_partials.resize(workers);
+        }
+
+        parallelForWorkers(workers, [&](int worker) {
+            std::vector<quint32> &hist = m_partials[worker];
+            if (hist.empty()) {
+                hist.assign(keyCount, 0);
+            }
+            const quint64 begin = workerRangeBegin(pixelCount, workers, worker);
+            const quint64 end = workerRangeEnd(pixelCount, workers, worker);
+            quint64 scanned = 0;
+            quint64 counted = 0;
+
+            for (quint64 blk = begin; blk < end; blk += progressBlock) {
+                if (this->isCanceled()) break;
+                const quint64 blkEnd = std::min(end, blk + progressBlock);
+                scanned += blkEnd - blk;
+
+                if (m_sampler) {
+                    for (quint64 p = blk; p < blkEnd; p++) {
+                        const quint8 *px = pixels + (m_sampler->pixelIndex(p) * numChannels);
+                        const quint32 opaque = !checkAlpha || px[3] != 0;
+                        hist[(quint32(px[chR]) << 16) | (quint32(px[chG]) << 8) | px[chB]] += opaque;
+                        counted += opaque;
+                    }
+                } else if (checkAlpha) {
+                    const quint8 *px = pixels + (blk * numChannels);
+                    for (quint64 p = blk; p < blkEnd; p++, px += numChannels) {
+                        // branchless, transparent pixels add zero
+                        const quint32 opaque = px[3] != 0;
+                        hist[(quint32(px[chR]) << 16) | (quint32(px[chG]) << 8) | px[chB]] += opaque;
+                        counted += opaque;
+                    }
+                } else {
+                    const quint8 *px = pixels + (blk * numChannels);
+                    for (quint64 p = blk; p < blkEnd; p++, px += numChannels) {
+                        hist[(quint32(px[chR]) << 16) | (quint32(px[chG]) << 8) | px[chB]]++;
+                    }
+                    counted += blkEnd - blk;
+                }
+                this->addProgress(blkEnd - blk);
+            }
+            m_skipped.fetch_add(scanned - counted, std::memory_order_relaxed);
+        });
+
+        if (!m_accumulate) {
+            reduce();
+        }
+    }
+
+    void endAccumulate() override
+    {
+        reduce();
+    }
+
+    void forEachColor(const std::function<void(const ImageRGBTyped<quint8> &)> &fn) const override
+    {
+        for (quint64 word = 0; word < m_occupancy.size(); word++) {
+            quint64 bits = m_occupancy[word];
+            while (bits) {
+                const quint32 key = static_cast<quint32>(word * 64 + qCountTrailingZeroBits(bits));
+                bits &= bits - 1;
+                ImageRGBTyped<quint8> c{static_cast<quint8>(key >> 16),
+                                        static_cast<quint8>((key >> 8) & 0xFF),
+                                        static_cast<quint8>(key & 0xFF)};
+                c.N = m_counts[key];
+                fn(c);
+            }
+        }
+    }
+
+    quint64 uniqueCount() const override
+    {
+        return m_unique;
+    }
+
+    void clear() override
+    {
+        std::vector<std::vector<quint32>>().swap(m_partials);
+        std::vector<quint32>().swap(m_counts);
+        std::vector<quint64>().swap(m_occupancy);
+        m_unique = 0;
+    }
+
+private:
+    // sums the partials into the final histogram and frees them
+    void reduce()
+    {
+        if (m_partials.empty()) {
+            return;
+        }
+
+        // the histogram of a previous reduce is summed like one more partial,
+        // the first partial doubles as the final histogram
+        if (!m_counts.empty()) {
+            m_partials.push_back(std::move(m_counts));
+        }
+        const int partialCount = static_cast<int>(m_partials.size());
+        m_counts.swap(m_partials[0]);
+        m_occupancy.assign(keyCount / 64, 0);
+
+        // key slices are multiples of 64 so every bitmap word belongs to one worker
+        const int reduceWorkers = suggestedWorkers(keyCount, keyCount / 64);
+        std::atomic<quint64> unique{0};
+        parallelForWorkers(reduceWorkers, [&](int worker) {
+            const quint64 wBegin = workerRangeBegin(keyCount / 64, reduceWorkers, worker);
+            const quint64 wEnd = workerRangeEnd(keyCount / 64, reduceWorkers, worker);
+            quint32 *dst = m_counts.data();
+            for (int w = 1; w < partialCount; w++) {
+                const quint32 *src = m_partials[w].data();
+                for (quint64 k = wBegin * 64; k < wEnd * 64; k++) {
+                    dst[k] += src[k];
+                }
+            }
+            quint64 localUnique = 0;
+            for (quint64 word = wBegin; word < wEnd; word++) {
+                quint64 bits = 0;
+                for (int b = 0; b < 64; b++) {
+                    bits |= static_cast<quint64>(dst[word * 64 + b] != 0) << b;
+                }
+                m_occupancy[word] = bits;
+                localUnique += static_cast<quint64>(qPopulationCount(bits));
+            }
+            unique.fetch_add(localUnique, std::memory_order_relaxed);
+        });
+        m_unique = unique;
+        std::vector<std::vector<quint32>>().swap(m_partials);
+    }
+
+    quint64 m_maxPartials{1};
+    quint64 m_unique{0};
+    // per worker histograms not reduced yet
+    std::vector<std::vector<quint32>> m_partials;
+    std::vector<quint32> m_counts;
+    std::vector<quint64> m_occupancy;
+};
+
+/*
+ * Radix sort duplicate finder for 16 bit channels
+ *
+ * The key space of 16 bit RGB is too big for a dense table, so the three raw
+ * channels are packed into a 48 bit key, sorted with a parallel LSD radix sort
+ * (12 bit digits, 4 passes, passes where every key shares the digit are
+ * skipped) and then run length counted. Costs 16 bytes per pixel while running,
+ * but only does a handful of linear passes, and the output comes sorted so the
+ * order of the unique colors is deterministic.
+ *
+ * Works on the raw bits, so it's fine for half floats as well, with -0 folded
+ * into 0.
+ */
+template<typename T>
+class RadixSortColorDedup : public ColorDedupEngine<T>
+{
+    static_assert(sizeof(T) == 2, "radix dedup packs 16 bit channels");
+
+    using ColorDedupEngine<T>::progressBlock;
+    using ColorDedupEngine<T>::m_processed;
+    using ColorDedupEngine<T>::m_skipped;
+    using ColorDedupEngine<T>::m_canceled;
+
+public:
+    void run(const T *pixels, quint64 pixelCount, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        const bool checkAlpha = (numChannels == 4 && skipTransparent);
+        const int workers = suggestedWorkers(pixelCount);
+
+        if (!this->m_accumulate) {
+            m_processed = 0;
+            m_skipped = 0;
+            clear();
+        }
+        const quint64 processedBefore = m_processed;
+
+        // the result of the previous runs, merged back in at the end
+        std::vector<quint64> prevKeys;
+        std::vector<quint32> prevCounts;
+        prevKeys.swap(m_keys);
+        prevCounts.swap(m_counts);
+
+        // count the opaque pixels first so the keys can be packed without gaps
+        std::vector<quint64> opaque(workers + 1, 0);
+        if (checkAlpha) {
+            parallelForWorkers(workers, [&](int worker) {
+                const quint64 end = workerRangeEnd(pixelCount, workers, worker);
+                quint64 n = 0;
+                for (quint64 p = workerRangeBegin(pixelCount, workers, worker); p < end; p++) {
+                    n += !(pixels[(this->pixelIndex(p) * numChannels) + 3] == T(0));
+                }
+                opaque[worker + 1] = n;
+            });
+        } else {
+            for (int w = 0; w < workers; w++) {
+                opaque[w + 1] = workerRangeEnd(pixelCount, workers, w) - workerRangeBegin(pixelCount, workers, w);
+            }
+        }
+        std::partial_sum(opaque.begin(), opaque.end(), opaque.begin());
+        const quint64 keyCount = opaque[workers];
+        m_skipped += pixelCount - keyCount;
+
+        std::vector<quint64> keys(keyCount);
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 end = workerRangeEnd(pixelCount, workers, worker);
+            quint64 out = opaque[worker];
+            for (quint64 p = workerRangeBegin(pixelCount, workers, worker); p < end; p++) {
+                const T *px = pixels + (this->pixelIndex(p) * numChannels);
+                if (checkAlpha && px[3] == T(0)) continue;
+                keys[out++] = pack(px[chR], px[chG], px[chB]);
+            }
+        });
+        // packing is about a quarter of the work, sorting the rest
+        const quint64 progressPerPass = pixelCount / (digitPasses + 1);
+        this->addProgress(progressPerPass);
+
+        std::vector<quint64> tmp(keyCount);
+        quint64 *src = keys.data();
+        quint64 *dst = tmp.data();
+        std::vector<std::vector<quint64>> hist(workers, std::vector<quint64>(digitBuckets));
+
+        for (int pass = 0; pass < digitPasses; pass++) {
+            if (this->isCanceled()) {
+                prevKeys.swap(m_keys);
+                prevCounts.swap(m_counts);
+                return;
+            }
+            const int shift = pass * digitBits;
+
+            parallelForWorkers(workers, [&](int worker) {
+                std::vector<quint64> &h = hist[worker];
+                std::fill(h.begin(), h.end(), 0);
+                const quint64 end = workerRangeEnd(keyCount, workers, worker);
+                for (quint64 i = workerRangeBegin(keyCount, workers, worker); i < end; i++) {
+                    h[(src[i] >> shift) & digitMask]++;
+                }
+            });
+
+            // turn the counts into scatter offsets, digit major then worker
+            quint64 offset = 0;
+            bool singleDigit = false;
+            for (quint64 digit = 0; digit < digitBuckets; digit++) {
+                quint64 digitTotal = 0;
+                for (int w = 0; w < workers; w++) {
+                    const quint64 c = hist[w][digit];
+                    hist[w][digit] = offset + digitTotal;
+                    digitTotal += c;
+                }
+                if (digitTotal == keyCount && keyCount > 0) {
+                    singleDigit = true;
+                }
+                offset += digitTotal;
+            }
+
+            if (!singleDigit) {
+                parallelForWorkers(workers, [&](int worker) {
+                    std::vector<quint64> &h = hist[worker];
+                    const quint64 end = workerRangeEnd(keyCount, workers, worker);
+                    for (quint64 i = workerRangeBegin(keyCount, workers, worker); i < end; i++) {
+                        dst[h[(src[i] >> shift) & digitMask]++] = src[i];
+                    }
+                });
+                std::swap(src, dst);
+            }
+            this->addProgress(progressPerPass);
+        }
+
+        // run length count, every worker emits the runs that start inside its range
+        std::vector<quint64> runs(workers + 1, 0);
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 end = workerRangeEnd(keyCount, workers, worker);
+            quint64 n = 0;
+            for (quint64 i = workerRangeBegin(keyCount, workers, worker); i < end; i++) {
+                n += (i == 0 || src[i] != src[i - 1]);
+            }
+            runs[worker + 1] = n;
+        });
+        std::partial_sum(runs.begin(), runs.end(), runs.begin());
+
+        m_keys.resize(runs[workers]);
+        m_counts.resize(runs[workers]);
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 end = workerRangeEnd(keyCount, workers, worker);
+            quint64 out = runs[worker];
+            for (quint64 i = workerRangeBegin(keyCount, workers, worker); i < end; i++) {
+                if (i != 0 && src[i] == src[i - 1]) continue;
+                quint64 j = i + 1;
+                while (j < keyCount && src[j] == src[i]) {
+                    j++;
+                }
+                m_keys[out] = src[i];
+                m_counts[out] = static_cast<quint32>(j - i);
+                out++;
+            }
+        });
+
+        if (!prevKeys.empty()) {
+            mergeSorted(prevKeys, prevCounts);
+        }
+        this->addProgress(processedBefore + pixelCount - m_processed.load(std::memory_order_relaxed));
+    }
+
+    void forEachColor(const std::function<void(const ImageRGBTyped<T> &)> &fn) const override
+    {
+        for (size_t i = 0; i < m_keys.size(); i++) {
+            ImageRGBTyped<T> c;
+            unpack(m_keys[i], c.R, c.G, c.B);
+            c.N = m_counts[i];
+            fn(c);
+        }
+    }
+
+    quint64 uniqueCount() const override
+    {
+        return m_keys.size();
+    }
+
+    void clear() override
+    {
+        std::vector<quint64>().swap(m_keys);
+        std::vector<quint32>().swap(m_counts);
+    }
+
+private:
+    static constexpr int digitBits = 12;
+    static constexpr int digitPasses = 4;
+    static constexpr quint64 digitBuckets = 1u << digitBits;
+    static constexpr quint64 digitMask = digitBuckets - 1;
+
+    // R in the high bits so the sorted output runs in RGB order
+    static inline quint64 pack(T r, T g, T b)
+    {
+        quint16 br, bg, bb;
+        std::memcpy(&br, &r, sizeof(quint16));
+        std::memcpy(&bg, &g, sizeof(quint16));
+        std::memcpy(&bb, &b, sizeof(quint16));
+        if constexpr (!std::numeric_limits<T>::is_integer) {
+            // -0 and 0 are the same color
+            br = (br == 0x8000) ? 0 : br;
+            bg = (bg == 0x8000) ? 0 : bg;
+            bb = (bb == 0x8000) ? 0 : bb;
+        }
+        return (static_cast<quint64>(br) << 32) | (static_cast<quint64>(bg) << 16) | bb;
+    }
+
+    // merges another sorted run list into m_keys/m_counts, equal keys add up
+    void mergeSorted(const std::vector<quint64> &keys, const std::vector<quint32> &counts)
+    {
+        std::vector<quint64> outKeys;
+        std::vector<quint32> outCounts;
+        outKeys.reserve(keys.size() + m_keys.size());
+        outCounts.reserve(keys.size() + m_keys.size());
+
+        size_t a = 0;
+        size_t b = 0;
+        while (a < keys.size() || b < m_keys.size()) {
+            if (b == m_keys.size() || (a < keys.size() && keys[a] < m_keys[b])) {
+                outKeys.push_back(keys[a]);
+                outCounts.push_back(counts[a++]);
+            } else if (a == keys.size() || m_keys[b] < keys[a]) {
+                outKeys.push_back(m_keys[b]);
+                outCounts.push_back(m_counts[b++]);
+            } else {
+                outKeys.push_back(keys[a]);
+                outCounts.push_back(counts[a++] + m_counts[b++]);
+            }
+        }
+        m_keys.swap(outKeys);
+        m_counts.swap(outCounts);
+    }
+
+    static inline void unpack(quint64 k, T &r, T &g, T &b)
+    {
+        const quint16 br = static_cast<quint16>(k >> 32);
+        const quint16 bg = static_cast<quint16>(k >> 16);
+        const quint16 bb = static_cast<quint16>(k);
+        std::memcpy(&r, &br, sizeof(quint16));
+        std::memcpy(&g, &bg, sizeof(quint16));
+        std::memcpy(&b, &bb, sizeof(quint16));
+    }
+
+    std::vector<quint64> m_keys;
+    std::vector<quint32> m_counts;
+};
+
+/*
+ * Quantized duplicate finder for float channels
+ *
+ * Float renders hardly ever repeat a color bit for bit, so exact dedup barely
+ * shrinks them. This one rounds every channel to mantissaBits of mantissa
+ * before keying, so nearby colors share a bucket, and keeps the channel sums
+ * to hand back the bucket mean instead of the rounded value. The relative
+ * step is 2^-mantissaBits, so it's roughly uniform in log space, which is what
+ * you want for HDR data. Sharded the same way as ShardedColorDedup.
+ */
+class QuantizedFloatDedup : public ColorDedupEngine<float>
+{
+public:
+    struct Bucket {
+        quint32 n{0};
+        double sum[3]{0.0, 0.0, 0.0};
+    };
+
+    typedef ColorKeyTraits<float>::Key Key;
+    typedef FlatColorTable<Key, Bucket> Shard;
+
+    static constexpr int fullMantissaBits = 23;
+
+    explicit QuantizedFloatDedup(int mantissaBits, int workers = QThread::idealThreadCount())
+        : m_workers(std::max(1, workers))
+        , m_dropBits(fullMantissaBits - std::min(std::max(mantissaBits, 0), fullMantissaBits))
+    {
+        while ((1 << m_shardBits) < m_workers) {
+            m_shardBits++;
+        }
+    }
+
+    int mantissaBits() const
+    {
+        return fullMantissaBits - m_dropBits;
+    }
+
+    void run(const float *pixels, quint64 pixelCount, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        const int workers = std::min(m_workers, suggestedWorkers(pixelCount));
+        beginFeed(workers, numChannels, chR, chG, chB, skipTransparent);
+
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 begin = workerRangeBegin(pixelCount, workers, worker);
+            const quint64 end = workerRangeEnd(pixelCount, workers, worker);
+            for (quint64 blk = begin; blk < end; blk += progressBlock) {
+                if (this->isCanceled()) break;
+                const quint64 blkEnd = std::min(end, blk + progressBlock);
+                scan<true>(worker, pixels, blk, blkEnd);
+                this->addProgress(blkEnd - blk);
+            }
+        });
+
+        endFeed();
+    }
+
+    bool beginFeed(int threads, quint8 numChannels, quint8 chR, quint8 chG, quint8 chB, bool skipTransparent) override
+    {
+        if (!this->m_accumulate) {
+            m_processed = 0;
+            m_skipped = 0;
+            m_shards.clear();
+        }
+        m_local.assign(std::max(1, threads), std::vector<Shard>(1 << m_shardBits));
+        m_numChannels = numChannels;
+        m_ch[0] = chR;
+        m_ch[1] = chG;
+        m_ch[2] = chB;
+        m_checkAlpha = (numChannels == 4 && skipTransparent);
+        return true;
+    }
+
+    void feed(int thread, const float *pixels, quint64 pixelCount) override
+    {
+        if (this->isCanceled()) return;
+        scan<false>(thread, pixels, 0, pixelCount);
+        this->addProgress(pixelCount);
+    }
+
+    void endFeed() override
+    {
+        const int numShards = 1 << m_shardBits;
+        const int threads = static_cast<int>(m_local.size());
+        m_shards.resize(numShards);
+
+        const int mergeWorkers = std::min(threads, numShards);
+        parallelForWorkers(mergeWorkers, [&](int worker) {
+            for (int s = worker; s < numShards; s += mergeWorkers) {
+                Shard &merged = m_shards[s];
+                int w = 0;
+                if (merged.size() == 0) {
+                    merged = std::move(m_local[0][s]);
+                    w = 1;
+                }
+                for (; w < threads; w++) {
+                    m_local[w][s].forEach([&](const Key &key, const Bucket &b) {
+                        Bucket &m = merged.findOrInsert(key, hashKey(key));
+                        m.n += b.n;
+                        m.sum[0] += b.sum[0];
+                        m.sum[1] += b.sum[1];
+                        m.sum[2] += b.sum[2];
+                    });
+                    m_local[w][s].clear();
+                }
+            }
+        });
+        std::vector<std::vector<Shard>>().swap(m_local);
+    }
+
+    // hands out the mean of every bucket
+    void forEachColor(const std::function<void(const ImageRGBTyped<float> &)> &fn) const override
+    {
+        for (const auto &s : m_shards) {
+            s.forEach([&](const Key &, const Bucket &b) {
+                ImageRGBTyped<float> c;
+                c.R = static_cast<float>(b.sum[0] / b.n);
+                c.G = static_cast<float>(b.sum[1] / b.n);
+                c.B = static_cast<float>(b.sum[2] / b.n);
+                c.N = b.n;
+                fn(c);
+            });
+        }
+    }
+
+    quint64 uniqueCount() const override
+    {
+        quint64 total = 0;
+        for (const auto &s : m_shards) {
+            total += s.size();
+        }
+        return total;
+    }
+
+    void clear() override
+    {
+        std::vector<Shard>().swap(m_shards);
+    }
+
+private:
+    // round to nearest on the magnitude bits, leave inf and nan alone, fold -0 into 0
+    inline quint32 quantize(float v) const
+    {
+        quint32 bits;
+        std::memcpy(&bits, &v, sizeof(float));
+        if (m_dropBits == 0) return bits;
+
+        const quint32 mag = bits & 0x7FFFFFFFu;
+        if (mag >= 0x7F800000u) return bits;
+        const quint32 rounded = (mag + (1u << (m_dropBits - 1))) & ~((1u << m_dropBits) - 1);
+        return rounded == 0 ? 0 : ((bits & 0x80000000u) | rounded);
+    }
+
+    inline int shardOf(quint64 hash) const
+    {
+        return static_cast<int>((hash >> 40) & ((1u << m_shardBits) - 1));
+    }
+
+    template<bool sampled>
+    void scan(int thread, const float *pixels, quint64 begin, quint64 end)
+    {
+        std::vector<Shard> &tables = m_local[thread];
+        quint64 skipAlpha = 0;
+        for (quint64 p = begin; p < end; p++) {
+            const float *px = pixels + ((sampled ? pixelIndex(p) : p) * m_numChannels);
+            if (m_checkAlpha && px[3] == 0) {
+                skipAlpha++;
+                continue;
+            }
+            const float r = px[m_ch[0]];
+            const float g = px[m_ch[1]];
+            const float b = px[m_ch[2]];
+            Key key;
+            key.c[0] = quantize(r);
+            key.c[1] = quantize(g);
+            key.c[2] = quantize(b);
+            const quint64 hash = hashKey(key);
+            Bucket &bucket = tables[shardOf(hash)].findOrInsert(key, hash);
+            bucket.n++;
+            bucket.sum[0] += r;
+            bucket.sum[1] += g;
+            bucket.sum[2] += b;
+        }
+        m_skipped.fetch_add(skipAlpha, std::memory_order_relaxed);
+    }
+
+    int m_workers{1};
+    int m_dropBits{0};
+    int m_shardBits{0};
+    std::vector<Shard> m_shards;
+
+    std::vector<std::vector<Shard>> m_local;
+    quint8 m_numChannels{4};
+    quint8 m_ch[3]{0, 1, 2};
+    bool m_checkAlpha{false};
+};
+
+/*
+ * Picks the duplicate finder for a given channel type and pixel count.
+ * floatMantissaBits only applies to float channels, anything outside
+ * [0, 23) keeps the exact colors.
+ */
+template<typename T>
+inline ColorDedupEngine<T> *createColorDedup(quint64 pixelCount, int floatMantissaBits = -1)
+{
+    Q_UNUSED(pixelCount)
+    Q_UNUSED(floatMantissaBits)
+    return new ShardedColorDedup<T>();
+}
+
+template<>
+inline ColorDedupEngine<float> *createColorDedup<float>(quint64 pixelCount, int floatMantissaBits)
+{
+    Q_UNUSED(pixelCount)
+    if (floatMantissaBits >= 0 && floatMantissaBits < QuantizedFloatDedup::fullMantissaBits) {
+        return new QuantizedFloatDedup(floatMantissaBits);
+    }
+    return new ShardedColorDedup<float>();
+}
+
+template<>
+inline ColorDedupEngine<quint8> *createColorDedup<quint8>(quint64 pixelCount, int floatMantissaBits)
+{
+    Q_UNUSED(floatMantissaBits)
+    if (pixelCount >= DenseColorHistogram8::minPixels) {
+        return new DenseColorHistogram8();
+    }
+    return new ShardedColorDedup<quint8>();
+}
+
+template<>
+inline ColorDedupEngine<quint16> *createColorDedup<quint16>(quint64 pixelCount, int floatMantissaBits)
+{
+    Q_UNUSED(pixelCount)
+    Q_UNUSED(floatMantissaBits)
+    return new RadixSortColorDedup<quint16>();
+}
+
+/*
+ * Picks an engine that supports beginFeed()/feed(), the hash based ones.
+ */
+template<typename T>
+inline ColorDedupEngine<T> *createFeedColorDedup(int floatMantissaBits = -1)
+{
+    Q_UNUSED(floatMantissaBits)
+    return new ShardedColorDedup<T>();
+}
+
+template<>
+inline ColorDedupEngine<float> *createFeedColorDedup<float>(int floatMantissaBits)
+{
+    if (floatMantissaBits >= 0 && floatMantissaBits < QuantizedFloatDedup::fullMantissaBits) {
+        return new QuantizedFloatDedup(floatMantissaBits);
+    }
+    return new ShardedColorDedup<float>();
+}
+
+/*
+ * Feeds the pixels a decoder pushes into an engine
+ *
+ * With an active sampler only the picked pixels of every run are gathered and
+ * fed, the rest are dropped right in the decoder callback.
+ */
+template<typename T>
+class ColorDedupFeed : public PixelFeed
+{
+public:
+    ColorDedupFeed(ColorDedupEngine<T> &engine,
+                   const StratifiedPixelSampler *sampler,
+                   quint8 numChannels,
+                   quint8 chR,
+                   quint8 chG,
+                   quint8 chB,
+                   bool skipTransparent)
+        : m_engine(engine)
+        , m_sampler((sampler && sampler->isActive()) ? sampler : nullptr)
+        , m_numChannels(numChannels)
+        , m_ch{chR, chG, chB}
+        , m_skipTransparent(skipTransparent)
+    {
+    }
+
+    bool begin(int threads) override
+    {
+        m_gather.assign(std::max(1, threads), std::vector<T>());
+        return m_engine.beginFeed(threads, m_numChannels, m_ch[0], m_ch[1], m_ch[2], m_skipTransparent);
+    }
+
+    void pixels(int thread, quint64 x, quint64 y, quint64 count, const void *data) override
+    {
+        const T *px = static_cast<const T *>(data);
+        if (!m_sampler) {
+            m_engine.feed(thread, px, count);
+            return;
+        }
+        std::vector<T> &gather = m_gather[thread];
+        gather.clear();
+        m_sampler->forEachPickInRow(y, x, x + count, [&](quint64 pickX) {
+            const T *src = px + ((pickX - x) * m_numChannels);
+            gather.insert(gather.end(), src, src + m_numChannels);
+        });
+        if (!gather.empty()) {
+            m_engine.feed(thread, gather.data(), gather.size() / m_numChannels);
+        }
+    }
+
+    bool isCanceled() const override
+    {
+        return m_engine.isCanceled();
+    }
+
+    void finish()
+    {
+        m_engine.endFeed();
+        std::vector<std::vector<T>>().swap(m_gather);
+    }
+
+private:
+    ColorDedupEngine<T> &m_engine;
+    const StratifiedPixelSampler *m_sampler{nullptr};
+    quint8 m_numChannels{4};
+    quint8 m_ch[3];
+    bool m_skipTransparent{true};
+    std::vector<std::vector<T>> m_gather;
+};
+
+// half has 65536 values per channel like 16 bit, radix sorting the raw bits is exact
+template<>
+inline ColorDedupEngine<qfloat16> *createColorDedup<qfloat16>(quint64 pixelCount, int floatMantissaBits)
+{
+    Q_UNUSED(pixelCount)
+    Q_UNUSED(floatMantissaBits)
+    return new RadixSortColorDedup<qfloat16>();
+}
+
+#endif // COLOR_DEDUP_H
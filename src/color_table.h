@@ -0,0 +1,272 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef COLOR_TABLE_H
+#define COLOR_TABLE_H
+
+#include <QFloat16>
+#include <QtGlobal>
+
+#include <cstring>
+#include <limits>
+#include <vector>
+
+/*
+ * Color keys
+ *
+ * Pixels are keyed on their packed channel bits. Integer channels up to 16 bit
+ * fit three to a quint64, anything wider is kept as three raw 32 bit words.
+ */
+struct ColorKey96 {
+    quint32 c[3];
+
+    friend bool operator==(const ColorKey96 &lhs, const ColorKey96 &rhs)
+    {
+        return (lhs.c[0] == rhs.c[0]) && (lhs.c[1] == rhs.c[1]) && (lhs.c[2] == rhs.c[2]);
+    }
+};
+
+// splitmix64 finalizer
+inline quint64 mixKey(quint64 k)
+{
+    k ^= k >> 30;
+    k *= 0xBF58476D1CE4E5B9ull;
+    k ^= k >> 27;
+    k *= 0x94D049BB133111EBull;
+    k ^= k >> 31;
+    return k;
+}
+
+inline quint64 hashKey(quint64 k)
+{
+    return mixKey(k);
+}
+
+inline quint64 hashKey(const ColorKey96 &k)
+{
+    return mixKey((static_cast<quint64>(k.c[1]) << 32 | k.c[0]) ^ mixKey(k.c[2]));
+}
+
+template<typename T, bool isInteger = std::numeric_limits<T>::is_integer>
+struct ColorKeyTraits;
+
+template<typename T>
+struct ColorKeyTraits<T, true> {
+    static_assert(sizeof(T) <= 2, "integer keys only pack up to 16 bit per channel");
+    typedef quint64 Key;
+
+    static inline Key pack(T r, T g, T b)
+    {
+        return static_cast<quint64>(r) | (static_cast<quint64>(g) << 16) | (static_cast<quint64>(b) << 32);
+    }
+    static inline void unpack(const Key &k, T &r, T &g, T &b)
+    {
+        r = static_cast<T>(k & 0xFFFF);
+        g = static_cast<T>((k >> 16) & 0xFFFF);
+        b = static_cast<T>((k >> 32) & 0xFFFF);
+    }
+};
+
+template<>
+struct ColorKeyTraits<float, false> {
+    typedef ColorKey96 Key;
+
+    // -0 and 0 are the same color, fold the sign so they share a key
+    static inline Key pack(float r, float g, float b)
+    {
+        if (r == 0.0f) r = 0.0f;
+        if (g == 0.0f) g = 0.0f;
+        if (b == 0.0f) b = 0.0f;
+
+        Key k;
+        std::memcpy(&k.c[0], &r, sizeof(float));
+        std::memcpy(&k.c[1], &g, sizeof(float));
+        std::memcpy(&k.c[2], &b, sizeof(float));
+        return k;
+    }
+    static inline void unpack(const Key &k, float &r, float &g, float &b)
+    {
+        std::memcpy(&r, &k.c[0], sizeof(float));
+        std::memcpy(&g, &k.c[1], sizeof(float));
+        std::memcpy(&b, &k.c[2], sizeof(float));
+    }
+};
+
+// half floats key on their bits like 16 bit integers, with -0 folded like float keys
+template<>
+struct ColorKeyTraits<qfloat16, false> {
+    typedef quint64 Key;
+
+    static inline Key pack(qfloat16 r, qfloat16 g, qfloat16 b)
+    {
+        if (r == qfloat16(0.0f)) r = qfloat16(0.0f);
+        if (g == qfloat16(0.0f)) g = qfloat16(0.0f);
+        if (b == qfloat16(0.0f)) b = qfloat16(0.0f);
+
+        quint16 br, bg, bb;
+        std::memcpy(&br, &r, sizeof(quint16));
+        std::memcpy(&bg, &g, sizeof(quint16));
+        std::memcpy(&bb, &b, sizeof(quint16));
+        return static_cast<quint64>(br) | (static_cast<quint64>(bg) << 16) | (static_cast<quint64>(bb) << 32);
+    }
+    static inline void unpack(const Key &k, qfloat16 &r, qfloat16 &g, qfloat16 &b)
+    {
+        const quint16 br = static_cast<quint16>(k & 0xFFFF);
+        const quint16 bg = static_cast<quint16>((k >> 16) & 0xFFFF);
+        const quint16 bb = static_cast<quint16>((k >> 32) & 0xFFFF);
+        std::memcpy(&r, &br, sizeof(quint16));
+        std::memcpy(&g, &bg, sizeof(quint16));
+        std::memcpy(&b, &bb, sizeof(quint16));
+    }
+};
+
+/*
+ * Flat open addressing table
+ *
+ * Linear probing over one contiguous slot array plus a control byte per slot,
+ * the control byte holds 7 bits of the hash so most mismatches never touch the
+ * key. Nothing is allocated per entry, the table only reallocates when doubling.
+ *
+ * Value is default constructed on first insert, so for a counter use quint32
+ * and just increment what findOrInsert() hands back.
+ */
+template<typename Key, typename Value = quint32>
+class FlatColorTable
+{
+public:
+    explicit FlatColorTable(size_t expected = 0)
+    {
+        reserve(expected);
+    }
+
+    void reserve(size_t expected)
+    {
+        size_t cap = minCapacity;
+        while (cap * maxLoadNum < expected * maxLoadDen) {
+            cap <<= 1;
+        }
+        if (cap > m_ctrl.size()) {
+            rehash(cap);
+        }
+    }
+
+    // hash must be hashKey(key), it is taken as argument so callers can reuse it for sharding
+    inline Value &findOrInsert(const Key &key, quint64 hash, bool *inserted = nullptr)
+    {
+        if ((m_size + 1) * maxLoadDen > m_ctrl.size() * maxLoadNum) {
+            rehash(m_ctrl.empty() ? minCapacity : m_ctrl.size() * 2);
+        }
+        const quint8 tag = tagOf(hash);
+        size_t pos = hash & m_mask;
+        while (true) {
+            const quint8 c = m_ctrl[pos];
+            if (c == 0) {
+                m_ctrl[pos] = tag;
+                m_slots[pos].key = key;
+                m_slots[pos].value = Value();
+                m_size++;
+                if (inserted) *inserted = true;
+                return m_slots[pos].value;
+            }
+            if (c == tag && m_slots[pos].key == key) {
+                if (inserted) *inserted = false;
+                return m_slots[pos].value;
+            }
+            pos = (pos + 1) & m_mask;
+        }
+    }
+
+    inline Value &operator[](const Key &key)
+    {
+        return findOrInsert(key, hashKey(key));
+    }
+
+    const Value *find(const Key &key) const
+    {
+        if (m_size == 0) return nullptr;
+        const quint64 hash = hashKey(key);
+        const quint8 tag = tagOf(hash);
+        size_t pos = hash & m_mask;
+        while (m_ctrl[pos] != 0) {
+            if (m_ctrl[pos] == tag && m_slots[pos].key == key) {
+                return &m_slots[pos].value;
+            }
+            pos = (pos + 1) & m_mask;
+        }
+        return nullptr;
+    }
+
+    // fn(const Key &, const Value &) for every entry, in slot order
+    template<typename Fn>
+    void forEach(Fn fn) const
+    {
+        for (size_t i = 0; i < m_ctrl.size(); i++) {
+            if (m_ctrl[i] != 0) {
+                fn(m_slots[i].key, m_slots[i].value);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool isEmpty() const
+    {
+        return m_size == 0;
+    }
+
+    void clear()
+    {
+        std::vector<quint8>().swap(m_ctrl);
+        std::vector<Slot>().swap(m_slots);
+        m_size = 0;
+        m_mask = 0;
+    }
+
+private:
+    struct Slot {
+        Key key;
+        Value value;
+    };
+
+    static constexpr size_t minCapacity = 64;
+    // keep the load under 7/10
+    static constexpr size_t maxLoadNum = 7;
+    static constexpr size_t maxLoadDen = 10;
+
+    static inline quint8 tagOf(quint64 hash)
+    {
+        return static_cast<quint8>(0x80 | (hash >> 57));
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<quint8> oldCtrl(capacity, 0);
+        std::vector<Slot> oldSlots(capacity);
+        oldCtrl.swap(m_ctrl);
+        oldSlots.swap(m_slots);
+        m_mask = capacity - 1;
+
+        for (size_t i = 0; i < oldCtrl.size(); i++) {
+            if (oldCtrl[i] == 0) continue;
+            size_t pos = hashKey(oldSlots[i].key) & m_mask;
+            while (m_ctrl[pos] != 0) {
+                pos = (pos + 1) & m_mask;
+            }
+            m_ctrl[pos] = oldCtrl[i];
+            m_slots[pos] = std::move(oldSlots[i]);
+        }
+    }
+
+    std::vector<quint8> m_ctrl;
+    std::vector<Slot> m_slots;
+    size_t m_size{0};
+    size_t m_mask{0};
+};
+
+#endif // COLOR_TABLE_H
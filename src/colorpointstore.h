@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef COLORPOINTSTORE_H
+#define COLORPOINTSTORE_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+// display color, full floats so extended (out of sRGB) values of 16 bit and float
+// inputs survive as converted, half floats would round them to 11 bits
+struct PackedColor {
+    float r;
+    float g;
+    float b;
+    float a;
+};
+
+/*
+ * Parsed color points, one column per attribute
+ *
+ * xyY is a float triplet per point with the same layout as QVector3D so the 3D
+ * chart can upload it as is, the display color (sRGB, alpha from the occurrence
+ * count) is four floats, and the occurrence count has its own column. That's
+ * 32 bytes per point against 48 for the old pair of xyY doubles and RGBA floats,
+ * and loops that only look at chromaticity don't drag the colors through the cache.
+ *
+ * The parser fills it, Scatter2dChart reads it in place by index and
+ * Custom3dChart takes it over with swap(), so the points are never copied.
+ */
+class ColorPointStore
+{
+public:
+    int size() const
+    {
+        return static_cast<int>(m_count.size());
+    }
+
+    bool isEmpty() const
+    {
+        return m_count.empty();
+    }
+
+    void resize(int n)
+    {
+        m_xyY.resize(static_cast<size_t>(n) * 3);
+        m_color.resize(n);
+        m_count.resize(n);
+    }
+
+    void clear()
+    {
+        m_xyY.clear();
+        m_color.clear();
+        m_count.clear();
+    }
+
+    void squeeze()
+    {
+        m_xyY.shrink_to_fit();
+        m_color.shrink_to_fit();
+        m_count.shrink_to_fit();
+    }
+
+    void swap(ColorPointStore &other)
+    {
+        m_xyY.swap(other.m_xyY);
+        m_color.swap(other.m_color);
+        m_count.swap(other.m_count);
+    }
+
+    void set(int i, float x, float y, float Y, const PackedColor &color, quint32 count)
+    {
+        float *p = m_xyY.data() + (static_cast<size_t>(i) * 3);
+        p[0] = x;
+        p[1] = y;
+        p[2] = Y;
+        m_color[i] = color;
+        m_count[i] = count;
+    }
+
+    // overwrites point to with point from, for in place compaction
+    void move(int to, int from)
+    {
+        const float *src = m_xyY.data() + (static_cast<size_t>(from) * 3);
+        float *dst = m_xyY.data() + (static_cast<size_t>(to) * 3);
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        m_color[to] = m_color[from];
+        m_count[to] = m_count[from];
+    }
+
+    float x(int i) const
+    {
+        return m_xyY[static_cast<size_t>(i) * 3];
+    }
+
+    float y(int i) const
+    {
+        return m_xyY[(static_cast<size_t>(i) * 3) + 1];
+    }
+
+    // luminance, the big Y
+    float luminance(int i) const
+    {
+        return m_xyY[(static_cast<size_t>(i) * 3) + 2];
+    }
+
+    const PackedColor &color(int i) const
+    {
+        return m_color[i];
+    }
+
+    quint32 count(int i) const
+    {
+        return m_count[i];
+    }
+
+    // raw columns
+    const float *xyYData() const
+    {
+        return m_xyY.data();
+    }
+
+    const PackedColor *colorData() const
+    {
+        return m_color.data();
+    }
+
+    const quint32 *countData() const
+    {
+        return m_count.data();
+    }
+
+private:
+    std::vector<float> m_xyY;
+    std::vector<PackedColor> m_color;
+    std::vector<quint32> m_count;
+};
+
+#endif // COLORPOINTSTORE_H
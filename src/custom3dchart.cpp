@@ -66,8 +66,8 @@ public:
     PlotSetting2D plotSetting;
     PlotSetting3D pState;
 
-    QVector<QVector3D> vecPosData;
-    QVector<QVector4D> vecColData;
+    // points until they're uploaded in initializeGL
+    ColorPointStore points;
     QVector<uint32_t> vecDataOrder;
 
     QVector3D m_whitePoint;
@@ -349,7 +349,7 @@ void Custom3dChart::initializeGL()
     d->scatterPosVbo->create();
     d->scatterPosVbo->bind();
     d->scatterPosVbo->setUsagePattern(QOpenGLBuffer::StaticDraw);
-    d->scatterPosVbo->allocate(d->vecPosData.constData(), d->vecPosData.size() * sizeof(QVector3D));
+    d->scatterPosVbo->allocate(d->points.xyYData(), d->points.size() * sizeof(QVector3D));
 
     // VAO for main program
     d->scatterVao.reset(new QOpenGLVertexArrayObject(context()));
@@ -361,7 +361,7 @@ void Custom3dChart::initializeGL()
     d->scatterPosVboCvt->create();
     d->scatterPosVboCvt->bind();
     d->scatterPosVboCvt->setUsagePattern(QOpenGLBuffer::DynamicDraw);
-    d->scatterPosVboCvt->allocate(d->vecPosData.constData(), d->vecPosData.size() * sizeof(QVector3D));
+    d->scatterPosVboCvt->allocate(d->points.xyYData(), d->points.size() * sizeof(QVector3D));
     d->scatterPrg->enableAttributeArray("aPosition");
     d->scatterPrg->setAttributeBuffer("aPosition", GL_FLOAT, 0, 3, 0);
 
@@ -370,7 +370,7 @@ void Custom3dChart::initializeGL()
     d->scatterColVbo->create();
     d->scatterColVbo->bind();
     d->scatterColVbo->setUsagePattern(QOpenGLBuffer::StaticDraw);
-    d->scatterColVbo->allocate(d->vecColData.constData(), d->vecColData.size() * sizeof(QVector4D));
+    d->scatterColVbo->allocate(d->points.colorData(), d->points.size() * sizeof(PackedColor));
     d->scatterPrg->enableAttributeArray("aColor");
     d->scatterPrg->setAttributeBuffer("aColor", GL_FLOAT, 0, 4, 0);
 
@@ -378,10 +378,8 @@ void Custom3dChart::initializeGL()
     d->scatterPrg->release();
 
     // clear all temporary storages
-    d->vecPosData.clear();
-    d->vecPosData.squeeze();
-    d->vecColData.clear();
-    d->vecColData.squeeze();
+    d->points.clear();
+    d->points.squeeze();
 
     /*
      * --------------------------------------------------
@@ -541,24 +539,18 @@ void Custom3dChart::initializeGL()
     d->adaptedColorCheckerNewVboOut->allocate(d->adaptedColorCheckerNew.constData(), d->adaptedColorCheckerNew.size() * sizeof(QVector3D));
 }
 
-void Custom3dChart::addDataPoints(QVector<ColorPoint> &dArray, QVector3D &dWhitePoint, QVector<ImageXYZDouble> &dOutGamut)
+void Custom3dChart::addDataPoints(ColorPointStore &dArray, QVector3D &dWhitePoint, QVector<ImageXYZDouble> &dOutGamut)
 {
-    // using double is a massive performance hit, so let's use float instead.. :3
-    foreach (const auto &cp, dArray) {
-        QVector3D xyypos{(float)cp.first.X, (float)cp.first.Y, (float)cp.first.Z};
-        // xyypos = xyypos - QVector3D{dWhitePoint.x(), dWhitePoint.y(), 0.0f};
-
-        d->vecPosData.append(xyypos);
-        d->vecColData.append(QVector4D{cp.second.R, cp.second.G, cp.second.B, cp.second.A});
-    }
-    d->arrsize = dArray.size();
+    // the store is already float xyY + float RGBA colors, the same layout the VBOs take,
+    // so just take it over and upload it as is
+    d->points.swap(dArray);
+    d->arrsize = d->points.size();
 
     foreach (const auto &gm, dOutGamut) {
         d->imageGamut.append(QVector3D{static_cast<float>(gm.X), static_cast<float>(gm.Y), static_cast<float>(gm.Z)});
     }
 
     dArray.clear();
-    dArray.squeeze();
 
     if (dWhitePoint.isNull()) {
         d->m_whitePoint = QVector3D{D65WPxyy[0], D65WPxyy[1], D65WPxyy[2]};
@@ -5,6 +5,7 @@
 #include <QKeyEvent>
 #include <QScopedPointer>
 
+#include "colorpointstore.h"
 #include "plot_typedefs.h"
 
 class Custom3dChart : public QOpenGLWidget
@@ -14,7 +15,7 @@ public:
     Custom3dChart(PlotSetting2D &plotSetting, QWidget *parent = nullptr);
     ~Custom3dChart();
 
-    void addDataPoints(QVector<ColorPoint> &dArray, QVector3D &dWhitePoint, QVector<ImageXYZDouble> &dOutGamut);
+    void addDataPoints(ColorPointStore &dArray, QVector3D &dWhitePoint, QVector<ImageXYZDouble> &dOutGamut);
     void passKeypres(QKeyEvent *e);
 
     void resetCamera();
@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#include "gamutboundary.h"
+#include "parallel_funcs.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <vector>
+
+GamutBoundaryCache &GamutBoundaryCache::instance()
+{
+    static GamutBoundaryCache cache;
+    return cache;
+}
+
+std::shared_ptr<const GamutBoundary> GamutBoundaryCache::boundary(const IccProfileRef &profile, cmsUInt32Number intent, int resolution)
+{
+    if (!profile.isValid() || resolution < 2) {
+        return nullptr;
+    }
+
+    const QByteArray key = profile.key + '|' + QByteArray::number(intent) + '|' + QByteArray::number(resolution);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_boundaries.find(key);
+        if (it != m_boundaries.end()) {
+            it->lastUse = ++m_useCounter;
+            return it->boundary;
+        }
+    }
+
+    IccTransformCache &iccCache = IccTransformCache::instance();
+    const IccHandle toXyz =
+        iccCache.transform(profile, TYPE_RGB_DBL, iccCache.builtinProfile(IccTransformCache::XYZProfile), TYPE_XYZ_DBL, intent);
+    if (!toXyz) {
+        return nullptr;
+    }
+
+    // computed outside of the lock, two parsers racing on the same key just do it twice
+    const std::shared_ptr<const GamutBoundary> result = compute(toXyz.get(), resolution);
+
+    QMutexLocker locker(&m_mutex);
+    while (m_boundaries.size() >= m_capacity) {
+        auto oldest = m_boundaries.begin();
+        for (auto it = m_boundaries.begin(); it != m_boundaries.end(); ++it) {
+            if (it->lastUse < oldest->lastUse) {
+                oldest = it;
+            }
+        }
+        m_boundaries.erase(oldest);
+    }
+    m_boundaries.insert(key, Entry{result, ++m_useCounter});
+    return result;
+}
+
+void GamutBoundaryCache::setCapacity(int boundaries)
+{
+    QMutexLocker locker(&m_mutex);
+    m_capacity = std::max(1, boundaries);
+}
+
+void GamutBoundaryCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_boundaries.clear();
+}
+
+std::shared_ptr<const GamutBoundary> GamutBoundaryCache::compute(cmsHTRANSFORM toXyz, int resolution)
+{
+    const int n = resolution;
+    const quint64 total = 6ULL * n;
+
+    std::vector<double> rgb(total * 3);
+
+    // edges, starting corner and which channel moves which way
+    struct Edge {
+        double start[3];
+        int channel;
+        bool rising;
+    };
+    static constexpr Edge edges[6] = {
+        {{1.0, 0.0, 0.0}, 1, true},  // R - Y
+        {{1.0, 1.0, 0.0}, 0, false}, // Y - G
+        {{0.0, 1.0, 0.0}, 2, true},  // G - C
+        {{0.0, 1.0, 1.0}, 1, false}, // C - B
+        {{0.0, 0.0, 1.0}, 0, true},  // B - M
+        {{1.0, 0.0, 1.0}, 2, false}, // M - R
+    };
+    double *p = rgb.data();
+    for (const Edge &e : edges) {
+        for (int i = 0; i < n; i++) {
+            const double t = static_cast<double>(i) / static_cast<double>(n);
+            p[0] = e.start[0];
+            p[1] = e.start[1];
+            p[2] = e.start[2];
+            p[e.channel] = e.rising ? t : 1.0 - t;
+            p += 3;
+        }
+    }
+
+    std::vector<double> xyz(total * 3);
+    std::vector<ImageXYZDouble> xyy(total);
+
+    const int workers = suggestedWorkers(total, 4096);
+    parallelForWorkers(workers, [&](int worker) {
+        const quint64 begin = workerRangeBegin(total, workers, worker);
+        const quint64 end = workerRangeEnd(total, workers, worker);
+        if (begin == end) {
+            return;
+        }
+        cmsDoTransform(toXyz, rgb.data() + (begin * 3), xyz.data() + (begin * 3), static_cast<cmsUInt32Number>(end - begin));
+        for (quint64 i = begin; i < end; i++) {
+            cmsCIEXYZ bufXYZ{xyz[(i * 3)], xyz[(i * 3) + 1], xyz[(i * 3) + 2]};
+            cmsCIExyY bufxyY;
+            cmsXYZ2xyY(&bufxyY, &bufXYZ);
+            xyy[i] = ImageXYZDouble{bufxyY.x, bufxyY.y, bufxyY.Y};
+        }
+    });
+
+    std::shared_ptr<GamutBoundary> result = std::make_shared<GamutBoundary>();
+    result->resolution = n;
+    result->outline = QVector<ImageXYZDouble>(xyy.begin(), xyy.end());
+
+    qDebug() << "Gamut boundary:" << result->outline.size() << "outline samples";
+
+    return result;
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef GAMUTBOUNDARY_H
+#define GAMUTBOUNDARY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QVector>
+
+#include <memory>
+
+#include <lcms2.h>
+
+#include "icctransformcache.h"
+#include "plot_typedefs.h"
+
+// xyY samples of the boundary of a profile's RGB cube
+struct GamutBoundary {
+    // closed loop along the cube edges R - Y - G - C - B - M, resolution samples per edge
+    QVector<ImageXYZDouble> outline;
+    int resolution{0};
+};
+
+/*
+ * Computes and caches gamut boundaries
+ *
+ * All edge samples go through the profile to XYZ transform in a few
+ * big cmsDoTransform calls split over the worker threads, instead of one call
+ * per sample. Results are keyed on the profile digest, intent and resolution,
+ * so parsing another image with the same profile doesn't compute it again.
+ * All functions are thread safe.
+ */
+class GamutBoundaryCache
+{
+public:
+    static GamutBoundaryCache &instance();
+
+    // null when the profile can't be transformed to XYZ
+    std::shared_ptr<const GamutBoundary> boundary(const IccProfileRef &profile, cmsUInt32Number intent, int resolution);
+
+    void setCapacity(int boundaries);
+    void clear();
+
+private:
+    GamutBoundaryCache() = default;
+    Q_DISABLE_COPY(GamutBoundaryCache)
+
+    static std::shared_ptr<const GamutBoundary> compute(cmsHTRANSFORM toXyz, int resolution);
+
+    struct Entry {
+        std::shared_ptr<const GamutBoundary> boundary;
+        quint64 lastUse{0};
+    };
+
+    QMutex m_mutex;
+    QHash<QByteArray, Entry> m_boundaries;
+    quint64 m_useCounter{0};
+    int m_capacity{8};
+};
+
+#endif // GAMUTBOUNDARY_H
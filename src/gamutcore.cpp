@@ -0,0 +1,151 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#include "gamutcore.h"
+#include "imageparsersc.h"
+
+#include "./gamutplotterconfig.h"
+
+#ifdef HAVE_JPEGXL
+#include "jxlreader.h"
+#endif
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QImageReader>
+
+#include <algorithm>
+
+// shared by the GUI and whoever else links the core
+bool ClampNegative = false;
+bool ClampPositive = false;
+
+namespace GamutCore
+{
+
+bool decodeImage(const QString &fileName, DecodedImage &out, QString *error, const ProgressToken *token)
+{
+    out = DecodedImage();
+
+#ifdef HAVE_JPEGXL
+    const QFileInfo fi(fileName);
+    if (fi.suffix() == "jxl" || fileName.isEmpty()) {
+        JxlReader jxlfile(fileName);
+        jxlfile.setProgressToken(token);
+        if (!jxlfile.processJxl()) {
+            if (error) {
+                *error = QStringLiteral("Failed to open JXL file!");
+            }
+            return false;
+        }
+        out.rawData = jxlfile.getRawImage();
+        out.rawIcc = jxlfile.getRawICC();
+        out.depth = jxlfile.getImageColorDepth();
+        out.size = jxlfile.getImageDimension();
+        return true;
+    }
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    QImageReader::setAllocationLimit(512);
+#endif
+    QImageReader reader(fileName);
+    out.image = reader.read();
+    if (out.image.isNull()) {
+        if (error) {
+            *error = QStringLiteral("Invalid or unsupported image format!");
+        }
+        return false;
+    }
+    out.size = out.image.size();
+    return true;
+}
+
+bool decodeImagePreview(const QString &fileName, int maxLongSide, DecodedImage &out)
+{
+    out = DecodedImage();
+
+#ifdef HAVE_JPEGXL
+    if (fileName.isEmpty() || QFileInfo(fileName).suffix() != "jxl") {
+        return false;
+    }
+
+    JxlReader jxlfile(fileName);
+    if (!jxlfile.processHeader()) {
+        return false;
+    }
+    // small images are sampled at full size anyway
+    const QSize size = jxlfile.getImageDimension();
+    if (std::max(size.width(), size.height()) <= maxLongSide) {
+        return false;
+    }
+    if (!jxlfile.processPreview()) {
+        return false;
+    }
+    out.rawData = jxlfile.getRawImage();
+    out.rawIcc = jxlfile.getRawICC();
+    out.depth = jxlfile.getImageColorDepth();
+    out.size = jxlfile.getImageDimension();
+    qDebug() << "Preview" << out.size << "of" << size;
+    return out.isRaw();
+#else
+    Q_UNUSED(fileName)
+    Q_UNUSED(maxLongSide)
+    return false;
+#endif
+}
+
+void parseImage(ImageParserSC &parser, const DecodedImage &img, int density, ColorPointStore *outCp)
+{
+    if (img.isRaw()) {
+        parser.inputFile(img.rawData, img.rawIcc, img.depth, img.size, density, outCp);
+    } else {
+        parser.inputFile(img.image, density, outCp);
+    }
+}
+
+bool parseImageFile(ImageParserSC &parser, const QString &fileName, int density, ColorPointStore *outCp, QString *error)
+{
+#ifdef HAVE_JPEGXL
+    if (fileName.isEmpty() || QFileInfo(fileName).suffix() == "jxl") {
+        // big frames are deduplicated straight from the decoder callbacks
+        JxlReader jxlfile(fileName);
+        if (!jxlfile.processHeader()) {
+            if (error) {
+                *error = QStringLiteral("Failed to open JXL file!");
+            }
+            return false;
+        }
+        const QSize size = jxlfile.getImageDimension();
+        jxlfile.setProgressToken(&parser.progress());
+        if (static_cast<quint64>(size.width()) * size.height() > streamingPixelThreshold) {
+            qDebug() << "Streaming" << size << "JXL from the decoder";
+            const bool parsed = parser.inputFeed(jxlfile.getRawICC(),
+                                                 jxlfile.getImageColorDepth(),
+                                                 size,
+                                                 jxlfile.getImageChannelCount(),
+                                                 density,
+                                                 outCp,
+                                                 [&jxlfile](PixelFeed *feed) {
+                                                     return jxlfile.processJxl(feed);
+                                                 });
+            if (!parsed && error) {
+                *error = QStringLiteral("Failed to decode JXL file!");
+            }
+            return parsed;
+        }
+    }
+#endif
+
+    DecodedImage decoded;
+    if (!decodeImage(fileName, decoded, error, &parser.progress())) {
+        return false;
+    }
+    parseImage(parser, decoded, density, outCp);
+    return true;
+}
+
+} // namespace GamutCore
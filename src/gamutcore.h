@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef GAMUTCORE_H
+#define GAMUTCORE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include "colorpointstore.h"
+#include "imageformats.h"
+#include "plot_typedefs.h"
+
+class ImageParserSC;
+struct ProgressToken;
+
+/*
+ * GUI free entry points of the plotting pipeline
+ *
+ * Everything here only needs QtGui and lcms (and libjxl when built with it),
+ * so it can be driven from the dialog, a benchmark or a batch tool alike.
+ * The parsing itself (dedup, conversion, trimming) lives in ImageParserSC,
+ * these wrap the steps around it.
+ */
+namespace GamutCore
+{
+
+struct DecodedImage {
+    // either a QImage from QImageReader...
+    QImage image;
+    // ...or interleaved raw pixels from the JXL decoder
+    QByteArray rawData;
+    QByteArray rawIcc;
+    ImageColorDepthID depth{Integer8BitsColorDepthID};
+    QSize size;
+
+    bool isRaw() const
+    {
+        return !rawData.isEmpty();
+    }
+};
+
+// an empty file name decodes the built in JXL art when JXL is available.
+// A canceled token stops JXL decodes early, other formats are read whole
+bool decodeImage(const QString &fileName, DecodedImage &out, QString *error = nullptr, const ProgressToken *token = nullptr);
+
+// a small draft of the image for a first plot, only JXL files larger than maxLongSide
+// have one (the embedded preview or the DC image), false otherwise
+bool decodeImagePreview(const QString &fileName, int maxLongSide, DecodedImage &out);
+
+// feeds the decoded image to the parser, blocking
+void parseImage(ImageParserSC &parser, const DecodedImage &img, int density, ColorPointStore *outCp);
+
+// JXL images with more pixels than this are parsed straight from the decoder callbacks
+constexpr quint64 streamingPixelThreshold = 64ULL * 1024 * 1024;
+
+// decodeImage() and parseImage() in one go, streaming big JXL images instead of decoding them whole
+bool parseImageFile(ImageParserSC &parser, const QString &fileName, int density, ColorPointStore *outCp, QString *error = nullptr);
+
+} // namespace GamutCore
+
+#endif // GAMUTCORE_H
@@ -7,6 +7,10 @@
 #include <QVector>
 #include <QVector3D>
 #include <QGenericMatrix>
+#include <QMatrix4x4>
+#include <QPointF>
+#include <QSizeF>
+#include <QDebug>
 
 static constexpr float xyz2srgb[9] = {3.2404542, -1.5371385, -0.4985314,
                                       -0.9692660, 1.8760108, 0.0415560,
@@ -109,7 +113,7 @@ inline QVector3D toSrgb(const QVector3D &v)
     return QVector3D{toSrgb(v.x()), toSrgb(v.y()), toSrgb(v.z())};
 }
 
-QVector3D srgbToXyz(const QVector3D &v)
+inline QVector3D srgbToXyz(const QVector3D &v)
 {
     const QGenericMatrix<3, 3, float> srgbxyz(srgb2xyzD65);
 
@@ -122,7 +126,7 @@ QVector3D srgbToXyz(const QVector3D &v)
     return xyz;
 }
 
-QVector3D srgbToXyy(const QVector3D &v)
+inline QVector3D srgbToXyy(const QVector3D &v)
 {
     const QGenericMatrix<3, 3, float> srgbxyz(srgb2xyzD65);
 
@@ -135,7 +139,7 @@ QVector3D srgbToXyy(const QVector3D &v)
     return xyzToXyy(xyz);
 }
 
-QVector3D xyzAdaptToIlluminant(const QVector3D &srcWhiteXYZ, const QVector3D &illuminant, const QVector3D &srcXYZ)
+inline QVector3D xyzAdaptToIlluminant(const QVector3D &srcWhiteXYZ, const QVector3D &illuminant, const QVector3D &srcXYZ)
 {
     if (sizeof(QVector3D) != sizeof(float) * 3) {
         qDebug() << "differ?";
@@ -204,7 +208,7 @@ enum UcsModes {
     UCS_1976_LUV_STAR
 };
 
-QVector3D xyyToUCS(const QVector3D &xyy, const QVector3D &wxyy, const UcsModes &mode)
+inline QVector3D xyyToUCS(const QVector3D &xyy, const QVector3D &wxyy, const UcsModes &mode)
 {
     // CIE Luv / Lu'v'
     const float e = 0.008856f;
@@ -250,7 +254,7 @@ QVector3D xyyToUCS(const QVector3D &xyy, const QVector3D &wxyy, const UcsModes &
     return oLuv;
 }
 
-QVector3D xyyToLab(const QVector3D &xyy, const QVector3D &wxyy)
+inline QVector3D xyyToLab(const QVector3D &xyy, const QVector3D &wxyy)
 {
     const float e = 0.008856f;
     const float k = 903.3f;
@@ -291,7 +295,7 @@ QVector3D xyyToLab(const QVector3D &xyy, const QVector3D &wxyy)
     return oLab;
 }
 
-QVector3D labToXYZ(const QVector3D &lab, const QVector3D &wxyz)
+inline QVector3D labToXYZ(const QVector3D &lab, const QVector3D &wxyz)
 {
     const float e = 0.008856f;
     const float k = 903.3f;
@@ -328,7 +332,7 @@ QVector3D labToXYZ(const QVector3D &lab, const QVector3D &wxyz)
     return xyz * wxyz;
 }
 
-QVector3D xyyToOklab(const QVector3D &xyy, const QVector3D &wxyy)
+inline QVector3D xyyToOklab(const QVector3D &xyy, const QVector3D &wxyy)
 {
     const QVector3D iXYZ = xyyToXyz(xyy);
     [[maybe_unused]]
@@ -380,7 +384,7 @@ QVector3D xyyToOklab(const QVector3D &xyy, const QVector3D &wxyy)
     return oLab;
 }
 
-QVector<QVector3D> getSrgbGamutxyy()
+inline QVector<QVector3D> getSrgbGamutxyy()
 {
     QVector<QVector3D> outGamut;
 
@@ -443,7 +447,7 @@ QVector<QVector3D> getSrgbGamutxyy()
     return outGamut;
 }
 
-QPointF projected(const QVector3D &pos, const QMatrix4x4 &mat, const QSizeF &scrSize)
+inline QPointF projected(const QVector3D &pos, const QMatrix4x4 &mat, const QSizeF &scrSize)
 {
     const QVector4D pospos(pos.x(), pos.y(), pos.z(), 1.0f);
     const QVector4D abspospos = mat * pospos;
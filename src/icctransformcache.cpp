@@ -0,0 +1,246 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#include "icctransformcache.h"
+#include "lutkernel.h"
+#include "matrixshaper.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+static IccHandle wrapProfile(cmsHPROFILE profile)
+{
+    if (!profile) {
+        return IccHandle();
+    }
+    return IccHandle(profile, [](void *p) {
+        cmsCloseProfile(p);
+    });
+}
+
+static IccHandle wrapTransform(cmsHTRANSFORM transform)
+{
+    if (!transform) {
+        return IccHandle();
+    }
+    return IccHandle(transform, [](void *p) {
+        cmsDeleteTransform(p);
+    });
+}
+
+IccTransformCache &IccTransformCache::instance()
+{
+    static IccTransformCache cache;
+    return cache;
+}
+
+IccProfileRef IccTransformCache::profile(const QByteArray &iccData)
+{
+    if (iccData.isEmpty()) {
+        return IccProfileRef();
+    }
+
+    const QByteArray key = QCryptographicHash::hash(iccData, QCryptographicHash::Sha1).toHex();
+
+    QMutexLocker locker(&m_mutex);
+    IccHandle handle = lookup(m_profiles, key);
+    if (!handle) {
+        handle = wrapProfile(cmsOpenProfileFromMem(iccData.constData(), iccData.size()));
+        if (!handle) {
+            qWarning() << "Cannot open ICC profile";
+            return IccProfileRef();
+        }
+        insert(m_profiles, m_profileCapacity, key, handle);
+    }
+    return IccProfileRef{key, handle};
+}
+
+IccProfileRef IccTransformCache::builtinProfile(BuiltinProfile id)
+{
+    const QByteArray key = [&]() {
+        switch (id) {
+        case SRGBProfile:
+            return QByteArray("builtin:srgb");
+        case ScRGBProfile:
+            return QByteArray("builtin:scrgb");
+        case XYZProfile:
+        default:
+            return QByteArray("builtin:xyz");
+        }
+    }();
+
+    QMutexLocker locker(&m_mutex);
+    IccHandle handle = lookup(m_profiles, key);
+    if (!handle) {
+        switch (id) {
+        case SRGBProfile:
+            handle = wrapProfile(cmsCreate_sRGBProfile());
+            break;
+        case ScRGBProfile: {
+            cmsToneCurve *linTRC = cmsBuildGamma(NULL, 1.0);
+            cmsToneCurve *linrgb[3]{linTRC, linTRC, linTRC};
+            const cmsCIExyY sRgbD65 = {0.3127, 0.3290, 1.0000};
+            const cmsCIExyYTRIPLE srgbPrim = {{0.6400, 0.3300, 0.2126},
+                                              {0.3000, 0.6000, 0.7152},
+                                              {0.1500, 0.0600, 0.0722}};
+            handle = wrapProfile(cmsCreateRGBProfile(&sRgbD65, &srgbPrim, linrgb));
+            cmsFreeToneCurve(linTRC);
+        } break;
+        case XYZProfile:
+        default:
+            handle = wrapProfile(cmsCreateXYZProfile());
+            break;
+        }
+        if (!handle) {
+            return IccProfileRef();
+        }
+        insert(m_profiles, m_profileCapacity, key, handle);
+    }
+    return IccProfileRef{key, handle};
+}
+
+IccHandle IccTransformCache::transform(const IccProfileRef &src,
+                                       cmsUInt32Number inFormat,
+                                       const IccProfileRef &dst,
+                                       cmsUInt32Number outFormat,
+                                       cmsUInt32Number intent,
+                                       cmsUInt32Number flags)
+{
+    if (!src.isValid() || !dst.isValid()) {
+        return IccHandle();
+    }
+
+    const QByteArray key = src.key + '>' + dst.key + '|' + QByteArray::number(inFormat) + '|'
+        + QByteArray::number(outFormat) + '|' + QByteArray::number(intent) + '|' + QByteArray::number(flags) + '|'
+        + QByteArray::number(cmsSetAdaptationState(-1));
+
+    QMutexLocker locker(&m_mutex);
+    IccHandle handle = lookup(m_transforms, key);
+    if (!handle) {
+        handle = wrapTransform(cmsCreateTransform(src.get(), inFormat, dst.get(), outFormat, intent, flags));
+        if (!handle) {
+            qWarning() << "Cannot create transform" << key;
+            return IccHandle();
+        }
+        insert(m_transforms, m_transformCapacity, key, handle);
+    }
+    return handle;
+}
+
+QByteArray IccTransformCache::xyzKernelKey(const IccProfileRef &src, cmsUInt32Number intent, const QByteArray &kernel) const
+{
+    return src.key + '|' + QByteArray::number(intent) + '|' + QByteArray::number(cmsSetAdaptationState(-1)) + '|' + kernel;
+}
+
+std::shared_ptr<const MatrixShaperKernel>
+IccTransformCache::matrixShaper(const IccProfileRef &src, cmsUInt32Number intent, int lutSize, double tolerance)
+{
+    if (!src.isValid()) {
+        return nullptr;
+    }
+
+    const QByteArray key = xyzKernelKey(src, intent, QByteArray::number(lutSize) + '|' + QByteArray::number(tolerance));
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_matrixShapers.find(key);
+        if (it != m_matrixShapers.end()) {
+            it->lastUse = ++m_useCounter;
+            return it->kernel;
+        }
+    }
+
+    const IccHandle toXyz = transform(src, TYPE_RGB_DBL, builtinProfile(XYZProfile), TYPE_XYZ_DBL, intent);
+
+    // built outside of the lock, two parsers racing on the same key just do it twice
+    std::shared_ptr<MatrixShaperKernel> kernel = std::make_shared<MatrixShaperKernel>();
+    if (!toXyz || !kernel->build(src.get(), toXyz.get(), lutSize, tolerance)) {
+        kernel.reset();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    evictOldest(m_matrixShapers, m_kernelCapacity);
+    m_matrixShapers.insert(key, KernelEntry<MatrixShaperKernel>{kernel, ++m_useCounter});
+    return kernel;
+}
+
+std::shared_ptr<const TetrahedralLutKernel> IccTransformCache::xyzLattice(const IccProfileRef &src, cmsUInt32Number intent, int latticeSize)
+{
+    if (!src.isValid() || latticeSize < 2) {
+        return nullptr;
+    }
+
+    const QByteArray key = xyzKernelKey(src, intent, QByteArray::number(latticeSize));
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_lattices.find(key);
+        if (it != m_lattices.end()) {
+            it->lastUse = ++m_useCounter;
+            return it->kernel;
+        }
+    }
+
+    const IccHandle toXyz = transform(src, TYPE_RGB_DBL, builtinProfile(XYZProfile), TYPE_XYZ_DBL, intent);
+
+    std::shared_ptr<TetrahedralLutKernel> kernel = std::make_shared<TetrahedralLutKernel>();
+    if (!kernel->build(toXyz, latticeSize)) {
+        kernel.reset();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    evictOldest(m_lattices, m_kernelCapacity);
+    m_lattices.insert(key, KernelEntry<TetrahedralLutKernel>{kernel, ++m_useCounter});
+    return kernel;
+}
+
+void IccTransformCache::setCapacity(int profiles, int transforms)
+{
+    QMutexLocker locker(&m_mutex);
+    m_profileCapacity = std::max(1, profiles);
+    m_transformCapacity = std::max(1, transforms);
+}
+
+void IccTransformCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_profiles.clear();
+    m_transforms.clear();
+    m_matrixShapers.clear();
+    m_lattices.clear();
+}
+
+IccHandle IccTransformCache::lookup(QHash<QByteArray, Entry> &cache, const QByteArray &key)
+{
+    auto it = cache.find(key);
+    if (it == cache.end()) {
+        return IccHandle();
+    }
+    it->lastUse = ++m_useCounter;
+    return it->handle;
+}
+
+void IccTransformCache::insert(QHash<QByteArray, Entry> &cache, int capacity, const QByteArray &key, const IccHandle &handle)
+{
+    evictOldest(cache, capacity);
+    cache.insert(key, Entry{handle, ++m_useCounter});
+}
+
+template<typename E>
+void IccTransformCache::evictOldest(QHash<QByteArray, E> &cache, int capacity)
+{
+    // caches are small, a linear scan for the oldest entry is fine
+    while (cache.size() >= capacity) {
+        auto oldest = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            if (it->lastUse < oldest->lastUse) {
+                oldest = it;
+            }
+        }
+        cache.erase(oldest);
+    }
+}
@@ -0,0 +1,116 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef ICCTRANSFORMCACHE_H
+#define ICCTRANSFORMCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+#include <memory>
+
+#include <lcms2.h>
+
+class MatrixShaperKernel;
+class TetrahedralLutKernel;
+
+// Owning handle of a cmsHPROFILE or cmsHTRANSFORM, closed when the last copy goes away.
+typedef std::shared_ptr<void> IccHandle;
+
+struct IccProfileRef {
+    // digest of the ICC bytes, or the name of a builtin profile
+    QByteArray key;
+    IccHandle handle;
+
+    bool isValid() const
+    {
+        return handle != nullptr;
+    }
+    cmsHPROFILE get() const
+    {
+        return handle.get();
+    }
+};
+
+/*
+ * Process wide cache of opened profiles and transforms
+ *
+ * Profiles are keyed on the digest of their ICC bytes, transforms on both
+ * profile keys plus formats, intent and flags, so parsers working on images
+ * with the same embedded profile share the same lcms objects. Both caches are
+ * LRU bounded, an evicted entry stays alive for as long as someone still holds
+ * its handle. The XYZ kernels built on top of a profile to XYZ transform are
+ * kept the same way, keyed on the profile, intent and kernel size, so their
+ * tables and error checks are computed once per profile instead of per parse.
+ * All functions are thread safe.
+ */
+class IccTransformCache
+{
+public:
+    enum BuiltinProfile {
+        SRGBProfile,
+        ScRGBProfile,
+        XYZProfile
+    };
+
+    static IccTransformCache &instance();
+
+    // invalid ref when the data is empty or not a profile
+    IccProfileRef profile(const QByteArray &iccData);
+    IccProfileRef builtinProfile(BuiltinProfile id);
+
+    IccHandle transform(const IccProfileRef &src,
+                        cmsUInt32Number inFormat,
+                        const IccProfileRef &dst,
+                        cmsUInt32Number outFormat,
+                        cmsUInt32Number intent,
+                        cmsUInt32Number flags = 0);
+
+    // null when the profile is not a matrix shaper or the kernel misses the tolerance
+    std::shared_ptr<const MatrixShaperKernel> matrixShaper(const IccProfileRef &src, cmsUInt32Number intent, int lutSize, double tolerance);
+    // null when the profile can't be transformed to XYZ
+    std::shared_ptr<const TetrahedralLutKernel> xyzLattice(const IccProfileRef &src, cmsUInt32Number intent, int latticeSize);
+
+    void setCapacity(int profiles, int transforms);
+    void clear();
+
+private:
+    IccTransformCache() = default;
+    Q_DISABLE_COPY(IccTransformCache)
+
+    struct Entry {
+        IccHandle handle;
+        quint64 lastUse{0};
+    };
+
+    // failed builds are kept too (null kernel), so they aren't retried on every parse
+    template<typename K>
+    struct KernelEntry {
+        std::shared_ptr<const K> kernel;
+        quint64 lastUse{0};
+    };
+
+    IccHandle lookup(QHash<QByteArray, Entry> &cache, const QByteArray &key);
+    void insert(QHash<QByteArray, Entry> &cache, int capacity, const QByteArray &key, const IccHandle &handle);
+    QByteArray xyzKernelKey(const IccProfileRef &src, cmsUInt32Number intent, const QByteArray &kernel) const;
+
+    template<typename E>
+    static void evictOldest(QHash<QByteArray, E> &cache, int capacity);
+
+    QMutex m_mutex;
+    QHash<QByteArray, Entry> m_profiles;
+    QHash<QByteArray, Entry> m_transforms;
+    QHash<QByteArray, KernelEntry<MatrixShaperKernel>> m_matrixShapers;
+    QHash<QByteArray, KernelEntry<TetrahedralLutKernel>> m_lattices;
+    quint64 m_useCounter{0};
+    int m_profileCapacity{16};
+    int m_transformCapacity{64};
+    // a 65^3 lattice is about 3 MiB
+    int m_kernelCapacity{4};
+};
+
+#endif // ICCTRANSFORMCACHE_H
@@ -5,16 +5,25 @@
  **/
 
 #include "imageparsersc.h"
+#include "color_dedup.h"
+#include "color_table.h"
+#include "colorpointstore.h"
+#include "parallel_funcs.h"
 #include "global_variables.h"
+#include "gamutboundary.h"
+#include "icctransformcache.h"
+#include "lutkernel.h"
+#include "matrixshaper.h"
+#include "pixel_sampler.h"
+#include "pixelfeed.h"
 
 #include <QVector3D>
 
 #include <QDebug>
 
-#include <QApplication>
 #include <QColorSpace>
+#include <QFloat16>
 #include <QImage>
-#include <QProgressDialog>
 #include <QRandomGenerator>
 
 #include <QFuture>
@@ -23,8 +32,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <set>
-#include <unordered_set>
+#include <vector>
 
 #include <lcms2.h>
 
@@ -51,10 +61,117 @@ inline double value(const T src)
     return dst;
 }
 
+// the bulk transforms take the samples as they are, integers unscaled
+template<typename T, typename std::enable_if_t<!std::numeric_limits<T>::is_integer, int> = 1>
+inline T bulkSample(const T src)
+{
+    return static_cast<T>(value<T>(src));
+}
+
+template<typename T, typename std::enable_if_t<std::numeric_limits<T>::is_integer, int> = 1>
+inline T bulkSample(const T src)
+{
+    return src;
+}
+
+// integer input indexes the matrix shaper tables directly, float interpolates them
+template<typename T>
+inline int matrixShaperLutSize()
+{
+    return std::numeric_limits<T>::is_integer ? static_cast<int>(std::numeric_limits<T>::max()) + 1 : 4097;
+}
+
+template<typename T>
+inline cmsUInt32Number bulkRgbFormat();
+
+template<>
+inline cmsUInt32Number bulkRgbFormat<quint8>()
+{
+    return TYPE_RGB_8;
+}
+
+template<>
+inline cmsUInt32Number bulkRgbFormat<quint16>()
+{
+    return TYPE_RGB_16;
+}
+
+template<>
+inline cmsUInt32Number bulkRgbFormat<qfloat16>()
+{
+    return TYPE_RGB_HALF_FLT;
+}
+
+template<>
+inline cmsUInt32Number bulkRgbFormat<float>()
+{
+    return TYPE_RGB_FLT;
+}
+
+// streamed strips are converted to what the whole image would be for that depth
+template<typename T>
+inline QImage::Format stripFormat();
+
+template<>
+inline QImage::Format stripFormat<quint8>()
+{
+    return QImage::Format_ARGB32;
+}
+
+template<>
+inline QImage::Format stripFormat<quint16>()
+{
+    return QImage::Format_RGBA64;
+}
+
+template<>
+inline QImage::Format stripFormat<qfloat16>()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    return QImage::Format_RGBA16FPx4;
+#else
+    return QImage::Format_Invalid;
+#endif
+}
+
+template<>
+inline QImage::Format stripFormat<float>()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    return QImage::Format_RGBA32FPx4;
+#else
+    return QImage::Format_Invalid;
+#endif
+}
+
+// rows per strip, about 64 MiB once converted to float
+inline int stripRows(int width)
+{
+    return std::max(1, static_cast<int>(std::min<quint64>((64ULL << 20) / (std::max(1, width) * 16ULL), 1 << 20)));
+}
+
+// hands out the rows of img as strips without copying them, cut on the sampler's cell rows
+static std::function<QImage()> imageStripReader(const QImage &img, const StratifiedPixelSampler *sampler)
+{
+    const int rows = stripRows(img.width());
+    return [img, rows, sampler, y = 0]() mutable -> QImage {
+        if (y >= img.height()) {
+            return QImage();
+        }
+        const int n = sampler->alignRow(std::min(y + rows, img.height())) - y;
+        QImage strip(img.constScanLine(y), img.width(), n, img.bytesPerLine(), img.format());
+        strip.setColorTable(img.colorTable());
+        y += n;
+        return strip;
+    };
+}
+
 const static float adaptationState = 0.0;
 const static cmsUInt32Number displayPreviewIntent = INTENT_RELATIVE_COLORIMETRIC;
 const static bool useMultithreadConversion = true;
 const static bool skipTransparent = true;
+// max XYZ / RGB difference allowed between the bulk and the double transforms
+const static double bulkTransformTolerance = 0.001;
 
 class Q_DECL_HIDDEN ImageParserSC::Private
 {
@@ -62,6 +179,7 @@ public:
     QSize m_dimension{};
     QString m_profileName{};
     QVector<ImageXYZDouble> m_outerGamut{};
+    int m_gamutResolution{100};
     QVector3D m_prfWtpt{};
 
     QByteArray m_rawProfile;
@@ -75,11 +193,31 @@ public:
 
     quint8 numChannels{4};
 
-    const quint8 *m_rawImageByte;
+    const quint8 *m_rawImageByte{nullptr};
     quint64 m_rawImageByteSize{0};
+
+    // when set, dedup pulls the pixels from here strip by strip instead of m_rawImageByte,
+    // m_streamPixelCount is what all strips add up to
+    std::function<QImage()> m_stripReader;
+    quint64 m_streamPixelCount{0};
+
+    // when set, runs a decoder that pushes the pixels into dedup itself
+    std::function<bool(PixelFeed *)> m_pixelPump;
+    bool m_pumpFailed{false};
     quint64 m_maxOccurence{0};
 
-    QVector<ColorPoint> *m_outCp{nullptr};
+    int m_floatMantissaBits{-1};
+
+    quint64 m_trimSeed{QRandomGenerator::global()->generate64()};
+    bool m_trimWeighted{false};
+
+    // picks the pixels when the image is bigger than the requested size
+    StratifiedPixelSampler m_sampler;
+    quint64 m_sampleSeed{QRandomGenerator::global()->generate64()};
+
+    ProgressToken m_progress;
+
+    ColorPointStore *m_outCp{nullptr};
 
     bool m_isSrgb{false};
     bool hasColorants{false};
@@ -88,15 +226,32 @@ public:
     cmsCIEXYZTRIPLE colorants;
     cmsCIEXYZ p_wtptXYZ{0,0,0};
 
+    // profiles and transforms are shared through IccTransformCache,
+    // the hs* handles are borrowed from the refs
+    IccProfileRef prfIMG;
+    IccProfileRef prfRGB;
+    IccProfileRef prfScRGB;
+    IccProfileRef prfXYZ;
+
     cmsHPROFILE hsIMG{nullptr};
     cmsHPROFILE hsRGB{nullptr};
     cmsHPROFILE hsScRGB{nullptr};
     cmsHPROFILE hsXYZ{nullptr};
 
-    cmsHTRANSFORM srgbtoxyz{nullptr};
-    cmsHTRANSFORM imgtoxyz{nullptr};
-    cmsHTRANSFORM xyztosrgb{nullptr};
-    cmsHTRANSFORM imgtosrgb{nullptr};
+    IccHandle srgbtoxyz;
+    IccHandle imgtoxyz;
+    IccHandle xyztosrgb;
+    IccHandle imgtosrgb;
+
+    // typed on the input depth with float output, used for the unique colors
+    IccHandle imgtoxyzBulk;
+    IccHandle imgtosrgbBulk;
+    // replaces imgtoxyzBulk for matrix/TRC profiles, shared through the transform cache
+    std::shared_ptr<const MatrixShaperKernel> m_matrixShaper;
+
+    // optional lattice approximation of imgtoxyzBulk for everything else, 0 is off
+    int m_xyzLatticeSize{0};
+    std::shared_ptr<const TetrahedralLutKernel> m_xyzLattice;
 };
 
 ImageParserSC::ImageParserSC()
@@ -109,39 +264,12 @@ ImageParserSC::~ImageParserSC()
 {
     qDebug() << "parser deleted";
 
-    if (d->srgbtoxyz) {
-        cmsDeleteTransform(d->srgbtoxyz);
-    }
-    if (d->imgtoxyz) {
-        cmsDeleteTransform(d->imgtoxyz);
-    }
-    if (d->xyztosrgb) {
-        cmsDeleteTransform(d->xyztosrgb);
-    }
-    if (d->imgtosrgb) {
-        cmsDeleteTransform(d->imgtosrgb);
-    }
-
-    if (d->hsIMG) {
-        cmsCloseProfile(d->hsIMG);
-    }
-    if (d->hsRGB) {
-        cmsCloseProfile(d->hsRGB);
-    }
-    if (d->hsScRGB) {
-        cmsCloseProfile(d->hsScRGB);
-    }
-    if (d->hsXYZ) {
-        cmsCloseProfile(d->hsXYZ);
-    }
-
     d.reset();
 }
 
-void ImageParserSC::inputFile(const QImage &imgIn, int size, QVector<ColorPoint> *outCp)
+void ImageParserSC::inputFile(const QImage &imgIn, int size, ColorPointStore *outCp)
 {
     const QByteArray imRawIcc = imgIn.colorSpace().iccProfile();
-    const int imLongSide = std::max(imgIn.width(), imgIn.height());
 
     d->m_rawImageByte = imgIn.constBits();
     d->m_rawImageByteSize = imgIn.sizeInBytes();
@@ -151,7 +279,8 @@ void ImageParserSC::inputFile(const QImage &imgIn, int size, QVector<ColorPoint>
     // Do not adapt to illuminant on Absolute Colorimetric
     // cmsSetAdaptationState(adaptationState);
 
-    d->hsIMG = cmsOpenProfileFromMem(imRawIcc.data(), imRawIcc.size());
+    d->prfIMG = IccTransformCache::instance().profile(imRawIcc);
+    d->hsIMG = d->prfIMG.get();
     d->m_rawProfile.append(imRawIcc);
     iccPutTransforms();
 
@@ -170,23 +299,14 @@ void ImageParserSC::inputFile(const QImage &imgIn, int size, QVector<ColorPoint>
         d->chB = 0;
     }
 
-    QImage img = [&]() {
-        if (imLongSide > size) {
-            return imgIn.scaled(size, size, Qt::KeepAspectRatio, Qt::FastTransformation);
-        }
-        return QImage();
-    }();
+    // big images are sampled in place instead of downscaled first
+    d->m_sampler.reset(imgIn.width(), imgIn.height(), size, d->m_sampleSeed);
 
     const auto imFmt = imgIn.format();
     switch (imFmt) {
     case QImage::Format_RGB32:
     case QImage::Format_ARGB32:
     case QImage::Format_ARGB32_Premultiplied: {
-        if (!img.isNull()) {
-            d->m_rawImageByte = img.constBits();
-            d->m_rawImageByteSize = img.sizeInBytes();
-        }
-
         // 32 bit is always BGR?
         d->chR = 2;
         d->chG = 1;
@@ -198,49 +318,25 @@ void ImageParserSC::inputFile(const QImage &imgIn, int size, QVector<ColorPoint>
     case QImage::Format_RGBX64:
     case QImage::Format_RGBA64:
     case QImage::Format_RGBA64_Premultiplied: {
-        if (!img.isNull()) {
-            d->m_rawImageByte = img.constBits();
-            d->m_rawImageByteSize = img.sizeInBytes();
-        }
-
         calculateFromRaw<quint16>();
     } break;
 
     default: {
-        QImage imm;
+        // converted to RGBA whatever the source order was
+        d->chR = 0;
+        d->chG = 1;
+        d->chB = 2;
 
-#if QT_VERSION < QT_VERSION_CHECK(6, 2, 0)
-        if (!img.isNull()) {
-            img.convertTo(QImage::Format_RGBA64);
-            d->m_rawImageByte = img.constBits();
-            d->m_rawImageByteSize = img.sizeInBytes();
-        } else {
-            imm = imgIn.convertToFormat(QImage::Format_RGBA64);
-            d->m_rawImageByte = imm.constBits();
-            d->m_rawImageByteSize = imm.sizeInBytes();
-        }
+        // converted a strip at a time instead of into a second full copy
+        d->m_stripReader = imageStripReader(imgIn, &d->m_sampler);
+        d->m_streamPixelCount = static_cast<quint64>(imgIn.width()) * imgIn.height();
 
+#if QT_VERSION < QT_VERSION_CHECK(6, 2, 0)
         calculateFromRaw<quint16>();
 #else
-        if (!img.isNull()) {
-            if (!(img.format() == QImage::Format_RGBA32FPx4 || img.format() == QImage::Format_RGBA32FPx4_Premultiplied)) {
-                img.convertTo(QImage::Format_RGBA32FPx4);
-            }
-            d->m_rawImageByte = img.constBits();
-            d->m_rawImageByteSize = img.sizeInBytes();
-        } else {
-            if (!(img.format() == QImage::Format_RGBA32FPx4 || img.format() == QImage::Format_RGBA32FPx4_Premultiplied)) {
-                imm = imgIn.convertedTo(QImage::Format_RGBA32FPx4);
-                d->m_rawImageByte = imm.constBits();
-                d->m_rawImageByteSize = imm.sizeInBytes();
-            } else {
-                d->m_rawImageByte = img.constBits();
-                d->m_rawImageByteSize = img.sizeInBytes();
-            }
-        }
-
         calculateFromRaw<float>();
 #endif
+        d->m_stripReader = nullptr;
     } break;
     }
 }
@@ -250,58 +346,118 @@ void ImageParserSC::inputFile(const QByteArray &rawData,
                               ImageColorDepthID depthId,
                               QSize imgSize,
                               int size,
-                              QVector<ColorPoint> *outCp)
+                              ColorPointStore *outCp)
 {
-    if (depthId != Float32BitsColorDepthID) {
-        qDebug() << "warning, depth is not float";
-    }
-
-    d->hsIMG = cmsOpenProfileFromMem(iccData.data(), iccData.size());
+    d->prfIMG = IccTransformCache::instance().profile(iccData);
+    d->hsIMG = d->prfIMG.get();
     d->m_rawProfile.append(iccData);
     iccPutTransforms();
 
     d->m_outCp = outCp;
-    d->numChannels = 3;
 
-    const int longestSize = std::max(imgSize.width(), imgSize.height());
-    const int resizedLongSizeRatio = std::ceil((longestSize * 1.0) / (size * 1.0));
-    const int resizedMaxPixelCount =
-        (imgSize.width() / resizedLongSizeRatio) * (imgSize.height() / resizedLongSizeRatio);
+    const quint64 pixelCount = static_cast<quint64>(imgSize.width()) * imgSize.height();
 
-    const quint64 pixelCount = imgSize.width() * imgSize.height();
+    d->m_sampler.reset(imgSize.width(), imgSize.height(), size, d->m_sampleSeed);
 
-    switch (depthId) {
-    case Float32BitsColorDepthID: {
-        const quint8 chNum = rawData.size() / pixelCount / sizeof(float);
-        d->numChannels = chNum;
+    d->chR = 0;
+    d->chG = 1;
+    d->chB = 2;
 
-        d->chR = 0;
-        d->chG = 1;
-        d->chB = 2;
+    d->m_rawImageByte = reinterpret_cast<const quint8 *>(rawData.constData());
+    d->m_rawImageByteSize = rawData.size();
 
-        QByteArray res;
-        if (pixelCount > resizedMaxPixelCount) {
-            QRandomGenerator *rng(QRandomGenerator::global());
-            quint64 it = 0;
-            while (it < resizedMaxPixelCount) {
-                const quint64 pixPointer = rng->bounded(static_cast<quint32>(pixelCount - 1)) * (sizeof(float) * chNum);
-                res.append(rawData.mid(pixPointer, sizeof(float) * chNum));
-                it++;
-            }
-            d->m_rawImageByte = reinterpret_cast<const quint8 *>(res.constData());
-            d->m_rawImageByteSize = res.size();
-        } else {
-            d->m_rawImageByte = reinterpret_cast<const quint8 *>(rawData.constData());
-            d->m_rawImageByteSize = rawData.size();
+    // interleaved samples in the decoded depth, RGB or RGBA
+    const auto setChannels = [&](size_t sampleSize) {
+        if (pixelCount == 0) {
+            return false;
         }
+        d->numChannels = static_cast<quint8>(rawData.size() / pixelCount / sampleSize);
+        return d->numChannels >= 3;
+    };
 
-        calculateFromRaw<float>();
-    } break;
+    switch (depthId) {
+    case Integer8BitsColorDepthID:
+        if (setChannels(sizeof(quint8))) {
+            calculateFromRaw<quint8>();
+            return;
+        }
+        break;
+    case Integer16BitsColorDepthID:
+        if (setChannels(sizeof(quint16))) {
+            calculateFromRaw<quint16>();
+            return;
+        }
+        break;
+    case Float16BitsColorDepthID:
+        if (setChannels(sizeof(qfloat16))) {
+            calculateFromRaw<qfloat16>();
+            return;
+        }
+        break;
+    case Float32BitsColorDepthID:
+        if (setChannels(sizeof(float))) {
+            calculateFromRaw<float>();
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    qWarning() << "Err: raw data doesn't match the depth" << depthId << "and size" << imgSize;
+}
+
+bool ImageParserSC::inputFeed(const QByteArray &iccData,
+                              ImageColorDepthID depthId,
+                              QSize imgSize,
+                              int channels,
+                              int size,
+                              ColorPointStore *outCp,
+                              const std::function<bool(PixelFeed *)> &decode)
+{
+    if (channels < 3 || channels > 4 || imgSize.isEmpty()) {
+        qWarning() << "Err: cannot feed" << channels << "channels of" << imgSize;
+        return false;
+    }
 
+    d->prfIMG = IccTransformCache::instance().profile(iccData);
+    d->hsIMG = d->prfIMG.get();
+    d->m_rawProfile.append(iccData);
+    iccPutTransforms();
+
+    d->m_outCp = outCp;
+    d->m_dimension = imgSize;
+
+    d->numChannels = static_cast<quint8>(channels);
+    d->chR = 0;
+    d->chG = 1;
+    d->chB = 2;
+
+    d->m_sampler.reset(imgSize.width(), imgSize.height(), size, d->m_sampleSeed);
+    d->m_streamPixelCount = static_cast<quint64>(imgSize.width()) * imgSize.height();
+    d->m_pixelPump = decode;
+    d->m_pumpFailed = false;
+
+    switch (depthId) {
+    case Integer8BitsColorDepthID:
+        calculateFromRaw<quint8>();
+        break;
+    case Integer16BitsColorDepthID:
+        calculateFromRaw<quint16>();
+        break;
+    case Float16BitsColorDepthID:
+        calculateFromRaw<qfloat16>();
+        break;
+    case Float32BitsColorDepthID:
+        calculateFromRaw<float>();
+        break;
     default:
-        qDebug() << "depth id not implemented yet";
+        qWarning() << "Err: unknown depth" << depthId;
+        d->m_pumpFailed = true;
         break;
     }
+
+    d->m_pixelPump = nullptr;
+    return !d->m_pumpFailed;
 }
 
 template<typename T>
@@ -313,8 +469,8 @@ void ImageParserSC::calculateFromRaw()
             cmsCIEXYZ bufXYZsRGB;
             cmsCIEXYZ bufXYZImg;
             const double pix[3] = {clr.redF(), clr.greenF(), clr.blueF()};
-            cmsDoTransform(d->srgbtoxyz, &pix, &bufXYZsRGB, 1);
-            cmsDoTransform(d->imgtoxyz, &pix, &bufXYZImg, 1);
+            cmsDoTransform(d->srgbtoxyz.get(), &pix, &bufXYZsRGB, 1);
+            cmsDoTransform(d->imgtoxyz.get(), &pix, &bufXYZImg, 1);
             if ((std::fabs(bufXYZsRGB.X - bufXYZImg.X) > 0.001) || (std::fabs(bufXYZsRGB.Y - bufXYZImg.Y) > 0.001)
                 || (std::fabs(bufXYZsRGB.Z - bufXYZImg.Z) > 0.001)) {
                 return false;
@@ -331,7 +487,7 @@ void ImageParserSC::calculateFromRaw()
             return bufxyY;
         } else {
             const double white[3] = {1.0, 1.0, 1.0};
-            cmsDoTransform(d->imgtoxyz, &white, &bufXYZ, 1);
+            cmsDoTransform(d->imgtoxyz.get(), &white, &bufXYZ, 1);
             cmsXYZ2xyY(&bufxyY, &bufXYZ);
             if (d->p_wtptXYZ.X == 0 && d->p_wtptXYZ.Y == 0 && d->p_wtptXYZ.Z == 0)
                 d->p_wtptXYZ = bufXYZ;
@@ -344,110 +500,134 @@ void ImageParserSC::calculateFromRaw()
     // const bool needTransform = (d->imgtosrgb && !d->m_isSrgb);
     const bool needTransform = d->imgtosrgb ? true : false;
 
-    std::function<QPair<QByteArray, QByteArray>(const QByteArray)> convertChunk = [&](const QByteArray input) {
-        QByteArray trimXyz;
-        QByteArray trimRgb;
-        const quint32 pxsize = input.size() / sizeof(double) / 3;
-        trimXyz.resize(input.size());
-        cmsDoTransform(d->imgtoxyz, input.constData(), trimXyz.data(), pxsize);
+    iccPutBulkTransforms<T>();
+    if (!d->imgtoxyzBulk || (needTransform && !d->imgtosrgbBulk)) {
+        qWarning("Err: Cannot create transforms");
+        return;
+    }
+
+    // both kernels are built once per profile and reused by later parses
+    IccTransformCache &iccCache = IccTransformCache::instance();
+    const IccProfileRef &xyzProfile = d->hsIMG ? d->prfIMG : d->prfRGB;
+    d->m_matrixShaper =
+        iccCache.matrixShaper(xyzProfile, INTENT_ABSOLUTE_COLORIMETRIC, matrixShaperLutSize<T>(), bulkTransformTolerance);
+    d->m_xyzLattice.reset();
+    if (d->m_matrixShaper) {
+        qDebug() << "Using matrix shaper kernel for XYZ";
+    } else if (d->hsIMG && d->m_xyzLatticeSize > 1) {
+        d->m_xyzLattice = iccCache.xyzLattice(d->prfIMG, INTENT_ABSOLUTE_COLORIMETRIC, d->m_xyzLatticeSize);
+    }
+
+    const T* rawImPtr = reinterpret_cast<const T*>(d->m_rawImageByte);
+
+    // every stage gets exactly sized buffers, 3 samples per unique color,
+    // the input stays in its own depth and the outputs are float
+    std::vector<T> trimRgbIn;
+    std::vector<float> trimXyz;
+    std::vector<float> trimRgbOut;
+    std::vector<quint32> numOcc;
+    quint32 trimmedSize = 0;
+
+    // converts unique colors [begin, end) straight into their output slots
+    const auto convertRange = [&](quint64 begin, quint64 end) {
+        const T *input = trimRgbIn.data() + (begin * 3);
+        const cmsUInt32Number pxsize = static_cast<cmsUInt32Number>(end - begin);
+        if (d->m_matrixShaper) {
+            d->m_matrixShaper->toXyz(input, trimXyz.data() + (begin * 3), pxsize);
+        } else if (d->m_xyzLattice) {
+            d->m_xyzLattice->toXyz(input, trimXyz.data() + (begin * 3), pxsize);
+        } else {
+            cmsDoTransform(d->imgtoxyzBulk.get(), input, trimXyz.data() + (begin * 3), pxsize);
+        }
         if (needTransform) {
-            trimRgb.resize(input.size() / 2);
-            cmsDoTransform(d->imgtosrgb, input.constData(), trimRgb.data(), pxsize);
-            // return QPair<QByteArray, QByteArray>{trimXyz, trimRgb};
+            cmsDoTransform(d->imgtosrgbBulk.get(), input, trimRgbOut.data() + (begin * 3), pxsize);
         } else {
-            for (quint32 i = 0; i < input.size(); i += sizeof(double) * 3) {
-                const double *rgbin = reinterpret_cast<const double *>(input.constData() + i);
-                const float rgb[3] = {static_cast<float>(rgbin[0]),
-                                      static_cast<float>(rgbin[1]),
-                                      static_cast<float>(rgbin[2])};
-                trimRgb.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&rgb), sizeof(rgb)));
+            float *output = trimRgbOut.data() + (begin * 3);
+            for (quint64 i = 0; i < pxsize * 3; i++) {
+                output[i] = static_cast<float>(value<T>(input[i]));
             }
         }
-        return QPair<QByteArray, QByteArray>{trimXyz, trimRgb};
     };
 
-    const T* rawImPtr = reinterpret_cast<const T*>(d->m_rawImageByte);
-
-    QByteArray rawTrimData;
-    QByteArray rawTrimXyz;
-    QByteArray rawTrimRgb;
-    quint32 trimmedSize = 0;
     {
-        QProgressDialog pDial;
-        pDial.setModal(true);
-
-        QVector<quint32> numOcc;
         {
-            pDial.reset();
-            pDial.setMinimum(0);
-            pDial.setMaximum(d->m_rawImageByteSize / sizeof(T));
-            pDial.setLabelText("Finding duplicate colors...");
-            pDial.setCancelButtonText("Stop");
-
-            pDial.show();
-            QGuiApplication::processEvents();
-            QGuiApplication::processEvents();
-
-            quint64 it = 0;
-            quint64 skipAlpha = 0;
-
-            std::unordered_set<ImageRGBTyped<T>> irgbTrim;
-            for (quint64 i = 0; i < d->m_rawImageByteSize / sizeof(T); i += d->numChannels) {
-                const T r = rawImPtr[i+d->chR];
-                const T g = rawImPtr[i+d->chG];
-                const T b = rawImPtr[i+d->chB];
-                const ImageRGBTyped<T> imgin{r,g,b};
-
-                if (d->numChannels == 4 && skipTransparent) {
-                    const T a = rawImPtr[i+3];
-                    if (a == 0) {
-                        skipAlpha++;
-                        continue;
-                    }
+            const quint64 pixelCount = d->m_sampler.isActive()            ? d->m_sampler.sampleCount()
+                : (d->m_stripReader || d->m_pixelPump) ? d->m_streamPixelCount
+                                                       : d->m_rawImageByteSize / sizeof(T) / d->numChannels;
+            d->m_progress.setStage(ParseDedup, pixelCount);
+
+            // 8 bit goes to a dense histogram when it's big enough, 16 bit and half are radix sorted,
+            // float is hashed, optionally quantized
+            const bool quantizeFloat = std::is_same<T, float>::value && d->m_floatMantissaBits >= 0
+                && d->m_floatMantissaBits < QuantizedFloatDedup::fullMantissaBits;
+            // pushed pixels need an engine that can be fed from the decoder threads
+            QScopedPointer<ColorDedupEngine<T>> irgbTrim(d->m_pixelPump
+                                                             ? createFeedColorDedup<T>(d->m_floatMantissaBits)
+                                                             : createColorDedup<T>(pixelCount, d->m_floatMantissaBits));
+            irgbTrim->setProgressToken(&d->m_progress);
+            if (d->m_pixelPump) {
+                // sampled as the runs arrive, the decoded frame is never held
+                ColorDedupFeed<T> feed(*irgbTrim, &d->m_sampler, d->numChannels, d->chR, d->chG, d->chB, skipTransparent);
+                if (!d->m_pixelPump(&feed)) {
+                    qWarning("Err: Decoding failed");
+                    d->m_pumpFailed = true;
+                    return;
                 }
-
-                const auto res = irgbTrim.insert(imgin);
-                if (!res.second) {
-                    res.first->N = res.first->N + 1;
+                feed.finish();
+            } else if (d->m_stripReader) {
+                irgbTrim->setSampler(&d->m_sampler);
+                // only one strip is held at a time, the engine keeps counting across them
+                irgbTrim->setAccumulate(true);
+                const QImage::Format fmt = stripFormat<T>();
+                int stripRow = 0;
+                for (QImage strip = d->m_stripReader(); !strip.isNull() && !d->m_progress.isCanceled();
+                     strip = d->m_stripReader()) {
+                    if (strip.format() != fmt) {
+                        strip.convertTo(fmt);
+                    }
+                    const quint64 stride = strip.bytesPerLine() / (sizeof(T) * 4);
+                    const quint64 stripPixels = d->m_sampler.isActive()
+                        ? d->m_sampler.setWindow(stripRow, strip.height(), stride)
+                        : static_cast<quint64>(strip.width()) * strip.height();
+                    stripRow += strip.height();
+                    irgbTrim->run(reinterpret_cast<const T *>(strip.constBits()),
+                                  stripPixels,
+                                  4,
+                                  d->chR,
+                                  d->chG,
+                                  d->chB,
+                                  skipTransparent);
                 }
+                irgbTrim->endAccumulate();
+            } else {
+                irgbTrim->setSampler(&d->m_sampler);
+                irgbTrim->run(rawImPtr, pixelCount, d->numChannels, d->chR, d->chG, d->chB, skipTransparent);
+            }
 
-                if (i % 200000 == 0) {
-                    if (pDial.wasCanceled()) break;
-                    const QString colorLoading = QString("Finding duplicate colors...\n%1").arg(QString::number(irgbTrim.size()));
-                    pDial.setLabelText(colorLoading);
-                    pDial.setValue(i);
-                    QGuiApplication::processEvents();
-                }
+            if (d->m_progress.isCanceled()) {
+                qWarning("Err: Parsing canceled");
+                return;
             }
 
+            const quint64 skipAlpha = irgbTrim->skippedPixels();
             qDebug() << "Skipped pixels (transparent):" << skipAlpha;
 
-            pDial.close();
-
-            pDial.reset();
-            pDial.setMinimum(0);
-            pDial.setMaximum(irgbTrim.size());
-            pDial.setLabelText("Processing...");
-            pDial.setCancelButtonText("Stop");
-
-            pDial.show();
-            QGuiApplication::processEvents();
-            QGuiApplication::processEvents();
+            trimRgbIn.resize(irgbTrim->uniqueCount() * 3);
+            numOcc.resize(irgbTrim->uniqueCount());
 
             ImageRGBTyped<T> maxocc;
-            for (const auto &i : irgbTrim) {
-                const double r = value<T>(i.R);
-                const double g = value<T>(i.G);
-                const double b = value<T>(i.B);
-                rawTrimData.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&r), sizeof(r)));
-                rawTrimData.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&g), sizeof(g)));
-                rawTrimData.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&b), sizeof(b)));
+            quint64 ndx = 0;
+            irgbTrim->forEachColor([&](const ImageRGBTyped<T> &i) {
+                trimRgbIn[(ndx * 3)] = bulkSample<T>(i.R);
+                trimRgbIn[(ndx * 3) + 1] = bulkSample<T>(i.G);
+                trimRgbIn[(ndx * 3) + 2] = bulkSample<T>(i.B);
+                numOcc[ndx] = i.N;
+                ndx++;
 
                 if (maxocc.N < i.N) {
                     maxocc = i;
                 }
-                numOcc.append(i.N);
-            }
+            });
 
             // {
             //     std::vector<ImageRGBTyped<T>> vectPixel(irgbTrim.size());
@@ -508,9 +688,9 @@ void ImageParserSC::calculateFromRaw()
 
             d->m_maxOccurence = maxocc.N;
 
-            trimmedSize = irgbTrim.size();
-            qDebug() << "From to" << d->m_rawImageByteSize / sizeof(T) / d->numChannels << irgbTrim.size();
-            irgbTrim.clear();
+            trimmedSize = irgbTrim->uniqueCount();
+            qDebug() << "From to" << pixelCount << trimmedSize;
+            irgbTrim->clear();
             {
                 if (std::numeric_limits<T>::is_integer) {
                     d->m_maxOccStr = QString("Most frequent: RGB[%1, %2, %3]:%4 | Total unique: %5")
@@ -526,152 +706,109 @@ void ImageParserSC::calculateFromRaw()
                                               QString::number(maxocc.B, 'f', 4),
                                               QString::number(maxocc.N),
                                               QString::number(trimmedSize));
+                    if (quantizeFloat) {
+                        d->m_maxOccStr += QString(" | Precision: %1 mantissa bits").arg(d->m_floatMantissaBits);
+                    } else {
+                        d->m_maxOccStr += QString(" | Precision: exact");
+                    }
+                }
+                if (d->m_xyzLattice) {
+                    d->m_maxOccStr += QString(" | XYZ lattice: %1^3, max error: %2")
+                                          .arg(QString::number(d->m_xyzLattice->latticeSize()),
+                                               QString::number(d->m_xyzLattice->maxError(), 'g', 3));
                 }
             }
             qDebug() << d->m_maxOccStr;
-
-            pDial.close();
         }
 
-        if (!rawTrimData.isEmpty()) {
-            if (!useMultithreadConversion) {
-                // Single threaded
-                pDial.reset();
-                pDial.setMinimum(0);
-                pDial.setMaximum(0);
-                pDial.setLabelText("Converting SP...");
-                pDial.setCancelButtonText("Stop");
-
-                pDial.show();
-                QGuiApplication::processEvents();
-                QGuiApplication::processEvents();
-
-                rawTrimXyz.resize(rawTrimData.size());
-                cmsDoTransform(d->imgtoxyz, rawTrimData.constData(), rawTrimXyz.data(), trimmedSize);
-                if (needTransform) {
-                    rawTrimRgb.resize(rawTrimData.size());
-                    cmsDoTransform(d->imgtosrgb, rawTrimData.constData(), rawTrimRgb.data(), trimmedSize);
-                } else {
-                    for (quint32 i = 0; i < rawTrimData.size(); i += sizeof(double) * 3) {
-                        const double *rgbin = reinterpret_cast<const double *>(rawTrimData.constData() + i);
-                        const float rgb[3] = {static_cast<float>(rgbin[0]),
-                                              static_cast<float>(rgbin[1]),
-                                              static_cast<float>(rgbin[2])};
-                        rawTrimRgb.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&rgb), sizeof(rgb)));
-                    }
+        if (!trimRgbIn.empty()) {
+            trimXyz.resize(trimRgbIn.size());
+            trimRgbOut.resize(trimRgbIn.size());
+
+            d->m_progress.setStage(ParseConvert, trimmedSize);
+
+            // Every chunk writes into its own slice of the outputs, workers pull the next
+            // chunk until none are left. A few chunks per core keeps the cores busy when
+            // some chunks are slower and lets the progress move, without chunks getting
+            // too small for lcms.
+            const quint64 chunkSize = suggestedChunkSize(trimmedSize);
+            const quint64 chunkCount = (trimmedSize + chunkSize - 1) / chunkSize;
+            std::atomic<quint64> nextChunk{0};
+
+            const int convertWorkers =
+                useMultithreadConversion ? static_cast<int>(std::min<quint64>(suggestedWorkers(chunkCount, 1), chunkCount)) : 1;
+            parallelForWorkers(convertWorkers, [&](int) {
+                while (!d->m_progress.isCanceled()) {
+                    const quint64 chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk >= chunkCount) break;
+                    const quint64 begin = chunk * chunkSize;
+                    const quint64 end = std::min<quint64>(begin + chunkSize, trimmedSize);
+                    convertRange(begin, end);
+                    d->m_progress.advance(end - begin);
                 }
-            } else {
-                // Multi threaded
-                int pos = 0, arrsize = rawTrimData.size(), sizeInArray = 100000 * sizeof(double) * 3;
-                QList<QByteArray> arrays;
-                while (pos < arrsize) {
-                    QByteArray arr = rawTrimData.mid(pos, sizeInArray);
-                    arrays << arr;
-                    pos += arr.size();
-                }
-
-                rawTrimData.clear();
-                rawTrimData.squeeze();
-
-                QFutureWatcher<QPair<QByteArray, QByteArray>> futureTmp;
-
-                pDial.reset();
-                pDial.setMinimum(0);
-                pDial.setMaximum(arrays.size());
-                pDial.setLabelText("Converting MP...");
-                pDial.setCancelButtonText("Stop");
-
-                QObject::connect(&futureTmp, &QFutureWatcher<void>::finished, &pDial, &QProgressDialog::reset);
-                QObject::connect(&pDial, &QProgressDialog::canceled, &futureTmp, &QFutureWatcher<void>::cancel);
-                QObject::connect(&futureTmp,
-                                 &QFutureWatcher<void>::progressRangeChanged,
-                                 &pDial,
-                                 &QProgressDialog::setRange);
-                QObject::connect(&futureTmp,
-                                 &QFutureWatcher<void>::progressValueChanged,
-                                 &pDial,
-                                 &QProgressDialog::setValue);
+            });
 
-                futureTmp.setFuture(QtConcurrent::mapped(arrays, convertChunk));
-
-                pDial.exec();
-                futureTmp.waitForFinished();
-
-                for (int i = 0; i < futureTmp.future().resultCount(); i++) {
-                    rawTrimXyz.append(futureTmp.resultAt(i).first);
-                    rawTrimRgb.append(futureTmp.resultAt(i).second);
-                }
-            }
-
-            pDial.close();
-
-            if (rawTrimXyz.size() / 2 != rawTrimRgb.size()) {
-                qWarning("Err: Different sized vector");
+            if (d->m_progress.isCanceled()) {
+                qWarning("Err: Parsing canceled");
                 return;
             }
 
-            pDial.reset();
-            pDial.setMinimum(0);
-            pDial.setMaximum(0);
-            pDial.setLabelText("Appending...");
-            pDial.setCancelButtonText("Stop");
-
-            pDial.show();
-            QGuiApplication::processEvents();
-            QGuiApplication::processEvents();
+            // the input colors are not needed anymore
+            std::vector<T>().swap(trimRgbIn);
 
-            float maxOccurenceLog = 0.0;
+            d->m_progress.setStage(ParseFinalize, trimmedSize);
 
-            maxOccurenceLog = std::log(static_cast<double>(d->m_maxOccurence));
+            // same as log(N) / log(max N) clamped to [0, 1], with the division hoisted out
+            const bool singleOccurence = (d->m_maxOccurence == 1);
+            const double invMaxOccurenceLog = singleOccurence ? 0.0 : 1.0 / std::log(static_cast<double>(d->m_maxOccurence));
+            const ImageXYZDouble nanFallback{d->m_prfWtpt.x(), d->m_prfWtpt.y(), 0.0};
 
             // QByteArray rawTrimXyy;
             // QByteArray trimRgbWithAlpha;
 
-            qDebug() << "XYZ size:" << rawTrimXyz.size() / 1024.0f / 1024.0f << "MiB";
-            qDebug() << "RGB size:" << rawTrimRgb.size() / 1024.0f / 1024.0f << "MiB";
-
-            for (quint64 i = 0; i < trimmedSize; i++) {
-                const quint64 bNdx = i * (sizeof(double) * 3);
-
-                const double* iXyz = reinterpret_cast<const double*>(rawTrimXyz.constData() + bNdx);
-                const float* iRgb = reinterpret_cast<const float*>(rawTrimRgb.constData() + (bNdx / 2));
-
-                const cmsCIEXYZ pix{iXyz[0], iXyz[1], iXyz[2]};
-                cmsCIExyY bufxyY;
-
-                cmsXYZ2xyY(&bufxyY, &pix);
-
-                const float alpha = [&]() {
-                    if (d->m_maxOccurence == 1) {
-                        return 1.0f;
-                    }
-                    return static_cast<float>(
-                        std::min(std::max(std::log(static_cast<double>(numOcc.at(i))) / maxOccurenceLog, (double)0.0),
-                                 (double)1.0));
-                }();
-
-                const ImageRGBFloat irgba = [&]() {
-                    return ImageRGBFloat{iRgb[0], iRgb[1], iRgb[2], numOcc.at(i), alpha};
-                }();
-
-                // temporary to output to file
-                // double xyytraspose[3] = {bufxyY.x - profileWtpt.x, bufxyY.y - profileWtpt.y, bufxyY.Y};
-                // rawTrimXyy.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&xyytraspose), sizeof(xyytraspose)));
-
-                // const float colrgba[4] = {iRgb[0], iRgb[1], iRgb[2], alpha};
-                // trimRgbWithAlpha.append(QByteArray::fromRawData(reinterpret_cast<const char*>(&colrgba), sizeof(colrgba)));
-
-                const ImageXYZDouble output = [&]() {
-                    if (bufxyY.x != bufxyY.x || bufxyY.y != bufxyY.y || bufxyY.Y != bufxyY.Y) {
-                        return ImageXYZDouble{d->m_prfWtpt.x(), d->m_prfWtpt.y(), 0.0};
+            qDebug() << "XYZ size:" << trimXyz.size() * sizeof(float) / 1024.0f / 1024.0f << "MiB";
+            qDebug() << "RGB size:" << trimRgbOut.size() * sizeof(float) / 1024.0f / 1024.0f << "MiB";
+
+            const int outOffset = d->m_outCp->size();
+            d->m_outCp->resize(outOffset + trimmedSize);
+            ColorPointStore *outCp = d->m_outCp;
+
+            // every index only touches its own slot, so the ranges run in parallel without locking
+            const int finalizeWorkers = suggestedWorkers(trimmedSize, 16384);
+            parallelForWorkers(finalizeWorkers, [&](int worker) {
+                const quint64 end = workerRangeEnd(trimmedSize, finalizeWorkers, worker);
+                for (quint64 i = workerRangeBegin(trimmedSize, finalizeWorkers, worker); i < end; i++) {
+                    const float *iXyz = trimXyz.data() + (i * 3);
+                    const float *iRgb = trimRgbOut.data() + (i * 3);
+
+                    // cmsXYZ2xyY, inlined
+                    const double X = iXyz[0];
+                    const double Y = iXyz[1];
+                    const double Z = iXyz[2];
+                    const double iSum = 1.0 / (X + Y + Z);
+                    const double x = X * iSum;
+                    const double y = Y * iSum;
+
+                    const float alpha = singleOccurence
+                        ? 1.0f
+                        : static_cast<float>(std::min(std::max(std::log(static_cast<double>(numOcc[i])) * invMaxOccurenceLog, 0.0), 1.0));
+
+                    // temporary to output to file
+                    // double xyytraspose[3] = {bufxyY.x - profileWtpt.x, bufxyY.y - profileWtpt.y, bufxyY.Y};
+                    // rawTrimXyy.append(QByteArray::fromRawData(reinterpret_cast<const char *>(&xyytraspose), sizeof(xyytraspose)));
+
+                    // const float colrgba[4] = {iRgb[0], iRgb[1], iRgb[2], alpha};
+                    // trimRgbWithAlpha.append(QByteArray::fromRawData(reinterpret_cast<const char*>(&colrgba), sizeof(colrgba)));
+
+                    const PackedColor color{iRgb[0], iRgb[1], iRgb[2], alpha};
+                    const int slot = outOffset + static_cast<int>(i);
+                    if (x != x || y != y || Y != Y) {
+                        outCp->set(slot, nanFallback.X, nanFallback.Y, nanFallback.Z, color, numOcc[i]);
+                    } else {
+                        outCp->set(slot, x, y, Y, color, numOcc[i]);
                     }
-                    return ImageXYZDouble{bufxyY.x, bufxyY.y, bufxyY.Y};
-                }();
-
-                const ColorPoint cp{output, irgba};
-
-                d->m_outCp->append(cp);
-            }
+                }
+            });
 
             // {
             //     const QString head = QString("DOUBLE VEC3 %1\n").arg(QString::number(rawTrimXyy.size() / sizeof(double) / 3));
@@ -683,11 +820,11 @@ void ImageParserSC::calculateFromRaw()
             //     out.write(trimRgbWithAlpha);
             //     out.close();
             // }
-
-            pDial.close();
         }
     }
 
+    d->m_progress.setStage(ParseGamut, 0);
+
     const bool hasColorantsButDiffer = [&]() {
         cmsCIExyY bufR;
         cmsCIExyY bufG;
@@ -703,19 +840,19 @@ void ImageParserSC::calculateFromRaw()
         {
             const double rgb[3] = {1.0, 0.0, 0.0};
             cmsCIEXYZ bufXYZ;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
+            cmsDoTransform(d->imgtoxyz.get(), &rgb, &bufXYZ, 1);
             cmsXYZ2xyY(&proR, &bufXYZ);
         }
         {
             const double rgb[3] = {0.0, 1.0, 0.0};
             cmsCIEXYZ bufXYZ;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
+            cmsDoTransform(d->imgtoxyz.get(), &rgb, &bufXYZ, 1);
             cmsXYZ2xyY(&proG, &bufXYZ);
         }
         {
             const double rgb[3] = {0.0, 0.0, 1.0};
             cmsCIEXYZ bufXYZ;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
+            cmsDoTransform(d->imgtoxyz.get(), &rgb, &bufXYZ, 1);
             cmsXYZ2xyY(&proB, &bufXYZ);
         }
 
@@ -730,7 +867,8 @@ void ImageParserSC::calculateFromRaw()
         return true;
     }();
 
-    if (d->hasColorants && hasColorantsButDiffer) {
+    const bool outlineFromColorants = d->hasColorants && hasColorantsButDiffer;
+    if (outlineFromColorants) {
         cmsCIExyY bufR;
         cmsCIExyY bufG;
         cmsCIExyY bufB;
@@ -764,91 +902,15 @@ void ImageParserSC::calculateFromRaw()
                 d->m_outerGamut.append(ImageXYZDouble{fX, fY, fYY});
             }
         }
-    } else {
-        const int sampleNum = 100;
-
-        // R - Y
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {1.0, secd, 0.0};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
-
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
-        }
-
-        // Y - G
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(sampleNum - i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {secd, 1.0, 0.0};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
-
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
-        }
-
-        // G - C
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {0.0, 1.0, secd};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
-
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
-        }
-
-        // C - B
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(sampleNum - i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {0.0, secd, 1.0};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
-
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
-        }
-
-        // B - M
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {secd, 0.0, 1.0};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
-
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
-        }
-
-        // M - R
-        for (int i = 0; i < sampleNum; i++) {
-            const double secd = static_cast<double>(sampleNum - i) / static_cast<double>(sampleNum);
-
-            const double rgb[3] = {1.0, 0.0, secd};
-            cmsCIEXYZ bufXYZ;
-            cmsCIExyY bufxyY;
-            cmsDoTransform(d->imgtoxyz, &rgb, &bufXYZ, 1);
-            cmsXYZ2xyY(&bufxyY, &bufXYZ);
+    }
 
-            const ImageXYZDouble output{bufxyY.x, bufxyY.y, bufxyY.Y};
-            d->m_outerGamut.append(output);
+    // otherwise the outline follows the profile along the cube edges
+    if (!outlineFromColorants) {
+        const IccProfileRef &gamutProfile = d->hsIMG ? d->prfIMG : d->prfRGB;
+        const std::shared_ptr<const GamutBoundary> boundary =
+            GamutBoundaryCache::instance().boundary(gamutProfile, INTENT_ABSOLUTE_COLORIMETRIC, d->m_gamutResolution);
+        if (boundary) {
+            d->m_outerGamut = boundary->outline;
         }
     }
 }
@@ -859,60 +921,61 @@ void ImageParserSC::trimImage(quint64 size)
 
     qDebug() << "Size before:" << d->m_outCp->size();
 
-    QProgressDialog pDial;
-    pDial.setModal(true);
-
-    quint64 it = 0;
-
-    if (d->m_outCp->size() > size && size != 0) {
-        pDial.reset();
-        pDial.setMinimum(0);
-        pDial.setMaximum(size);
-        pDial.setLabelText("Trimming...(2nd pass)");
-        pDial.setCancelButtonText("Stop");
-
-        pDial.show();
-        QGuiApplication::processEvents();
-        QGuiApplication::processEvents();
-
-        it = 0;
-
-        QRandomGenerator rng(QRandomGenerator::global()->generate());
-        std::unordered_set<ColorPoint> imm2;
-
-        quint32 it2 = 0;
-
-        while (true) {
-            const quint64 indx = rng.bounded(d->m_outCp->size() - 1);
-            const auto stat = imm2.insert(d->m_outCp->at(indx));
-
-            if (stat.second) {
-                it++;
-                if (it % 10000 == 0) {
-                    if (pDial.wasCanceled()) break;
-                    const QString colorLoading = QString("Trimming...(2nd pass)\n%1").arg(QString::number(imm2.size()));
-                    pDial.setLabelText(colorLoading);
-                    pDial.setValue(it);
-                    QGuiApplication::processEvents();
-                }
-
-                if (it == size) break;
+    const quint64 total = d->m_outCp->size();
+
+    if (total > size && size != 0) {
+        d->m_progress.setStage(ParseTrim, total);
+
+        // Efraimidis-Spirakis: every point gets the key u^(1/w) and the size largest keys
+        // are kept, log(u) / w orders the same without underflowing. Unweighted is just u.
+        ColorPointStore *points = d->m_outCp;
+        const quint64 seed = d->m_trimSeed;
+        const bool weighted = d->m_trimWeighted;
+        std::vector<double> keys(total);
+
+        const int workers = suggestedWorkers(total, 65536);
+        parallelForWorkers(workers, [&](int worker) {
+            const quint64 begin = workerRangeBegin(total, workers, worker);
+            const quint64 end = workerRangeEnd(total, workers, worker);
+            for (quint64 i = begin; i < end; i++) {
+                const double u = counterRandomUnit(seed, i);
+                keys[i] = weighted ? std::log(u) / std::max<quint32>(1, points->count(i)) : u;
             }
-            it2++;
+            d->m_progress.advance(end - begin);
+        });
 
-            // Limit considerably
-            // Seriously how do I ...
-            if (it2 > size * 4)
-                break;
+        if (d->m_progress.isCanceled()) {
+            return;
         }
 
-        d->m_outCp->clear();
-        d->m_outCp->squeeze();
-        for (const auto &im: imm2) {
-            d->m_outCp->append(im);
+        // the size-th largest key is the threshold, ties on it go to the lowest indices
+        const auto threshold = [&]() {
+            std::vector<double> sel(keys);
+            std::nth_element(sel.begin(), sel.begin() + (size - 1), sel.end(), std::greater<double>());
+            const double kth = sel[size - 1];
+            const quint64 above = std::count_if(sel.begin(), sel.begin() + (size - 1), [&](double k) {
+                return k > kth;
+            });
+            return std::make_pair(kth, size - above);
+        }();
+        quint64 ties = threshold.second;
+
+        // compact in place, picks keep their original order
+        quint64 out = 0;
+        for (quint64 i = 0; i < total && out < size; i++) {
+            bool keep = keys[i] > threshold.first;
+            if (!keep && keys[i] == threshold.first && ties > 0) {
+                ties--;
+                keep = true;
+            }
+            if (keep) {
+                if (out != i) {
+                    points->move(out, i);
+                }
+                out++;
+            }
         }
-
-        pDial.close();
+        d->m_outCp->resize(static_cast<int>(out));
     }
 
     d->m_outCp->squeeze();
@@ -920,6 +983,7 @@ void ImageParserSC::trimImage(quint64 size)
     qDebug() << "Size trim 2 (final):" << d->m_outCp->size();
 
     d->alreadyTrimmed = true;
+    d->m_progress.setStage(ParseDone, 0);
 }
 
 void ImageParserSC::iccParseWPColorant()
@@ -1019,21 +1083,20 @@ void ImageParserSC::iccPutTransforms()
     // Do not adapt to illuminant on Absolute Colorimetric
     cmsSetAdaptationState(adaptationState);
 
-    d->hsRGB = cmsCreate_sRGBProfile();
+    IccTransformCache &iccCache = IccTransformCache::instance();
+
+    d->prfRGB = iccCache.builtinProfile(IccTransformCache::SRGBProfile);
+    d->hsRGB = d->prfRGB.get();
 
     /*
      * Reserved in case I need linear / scRGB
      * maybe Qt 6+ where there will be Float QImage?
      */
-    cmsToneCurve *linTRC = cmsBuildGamma(NULL, 1.0);
-    cmsToneCurve *linrgb[3]{linTRC, linTRC, linTRC};
-    const cmsCIExyY sRgbD65 = {0.3127, 0.3290, 1.0000};
-    const cmsCIExyYTRIPLE srgbPrim = {{0.6400, 0.3300, 0.2126},
-                                      {0.3000, 0.6000, 0.7152},
-                                      {0.1500, 0.0600, 0.0722}};
-    d->hsScRGB = cmsCreateRGBProfile(&sRgbD65, &srgbPrim, linrgb);
+    d->prfScRGB = iccCache.builtinProfile(IccTransformCache::ScRGBProfile);
+    d->hsScRGB = d->prfScRGB.get();
 
-    d->hsXYZ = cmsCreateXYZProfile();
+    d->prfXYZ = iccCache.builtinProfile(IccTransformCache::XYZProfile);
+    d->hsXYZ = d->prfXYZ.get();
 
     if (d->hsIMG) {
         cmsUInt32Number tmpSize = 0;
@@ -1046,21 +1109,102 @@ void ImageParserSC::iccPutTransforms()
         iccParseWPColorant();
     }
 
-    d->srgbtoxyz =
-        cmsCreateTransform(d->hsRGB, TYPE_RGB_DBL, d->hsXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC, 0);
+    d->srgbtoxyz = iccCache.transform(d->prfRGB, TYPE_RGB_DBL, d->prfXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC);
     d->imgtoxyz = [&]() {
         if (d->hsIMG) {
-            return cmsCreateTransform(d->hsIMG, TYPE_RGB_DBL, d->hsXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC, 0);
+            return iccCache.transform(d->prfIMG, TYPE_RGB_DBL, d->prfXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC);
         } else {
-            return cmsCreateTransform(d->hsRGB, TYPE_RGB_DBL, d->hsXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC, 0);
+            return iccCache.transform(d->prfRGB, TYPE_RGB_DBL, d->prfXYZ, TYPE_XYZ_DBL, INTENT_ABSOLUTE_COLORIMETRIC);
         }
     }();
 
     if (d->hsIMG) {
-        d->imgtosrgb = cmsCreateTransform(d->hsIMG, TYPE_RGB_DBL, d->hsRGB, TYPE_RGB_FLT, displayPreviewIntent, 0);
+        d->imgtosrgb = iccCache.transform(d->prfIMG, TYPE_RGB_DBL, d->prfRGB, TYPE_RGB_FLT, displayPreviewIntent);
+    }
+
+    d->xyztosrgb = iccCache.transform(d->prfXYZ, TYPE_XYZ_DBL, d->prfRGB, TYPE_RGB_FLT, displayPreviewIntent);
+}
+
+template<typename T>
+void ImageParserSC::iccPutBulkTransforms()
+{
+    IccTransformCache &iccCache = IccTransformCache::instance();
+    const cmsUInt32Number inFormat = bulkRgbFormat<T>();
+
+    const auto createBulk = [&](cmsUInt32Number flags) {
+        d->imgtoxyzBulk = iccCache.transform(d->hsIMG ? d->prfIMG : d->prfRGB,
+                                             inFormat,
+                                             d->prfXYZ,
+                                             TYPE_XYZ_FLT,
+                                             INTENT_ABSOLUTE_COLORIMETRIC,
+                                             flags);
+        d->imgtosrgbBulk.reset();
+        if (d->hsIMG && d->imgtosrgb) {
+            d->imgtosrgbBulk = iccCache.transform(d->prfIMG, inFormat, d->prfRGB, TYPE_RGB_FLT, displayPreviewIntent, flags);
+        }
+    };
+
+    // probe random colors through the bulk transforms and an unoptimized double reference.
+    // optimized pipelines are exact on their LUT nodes, so keep the probe off a regular grid
+    const auto bulkError = [&]() {
+        const int probeCount = 729;
+        QRandomGenerator rng(0x5eed);
+        std::vector<T> probe;
+        std::vector<double> probeDbl;
+        probe.reserve(probeCount * 3);
+        probeDbl.reserve(probeCount * 3);
+        for (int i = 0; i < probeCount * 3; i++) {
+            const double v = rng.generateDouble();
+            const T sample = std::numeric_limits<T>::is_integer
+                ? static_cast<T>(std::lround(v * std::numeric_limits<T>::max()))
+                : static_cast<T>(v);
+            probe.push_back(sample);
+            probeDbl.push_back(value<T>(sample));
+        }
+
+        const IccProfileRef &src = d->hsIMG ? d->prfIMG : d->prfRGB;
+        const IccHandle refToXyz = iccCache.transform(src, TYPE_RGB_DBL, d->prfXYZ, TYPE_XYZ_DBL,
+                                                      INTENT_ABSOLUTE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE);
+        if (!refToXyz) {
+            return 0.0;
+        }
+
+        double maxErr = 0.0;
+        std::vector<float> bulkOut(probe.size());
+        std::vector<double> ref(probe.size());
+        cmsDoTransform(d->imgtoxyzBulk.get(), probe.data(), bulkOut.data(), probeCount);
+        cmsDoTransform(refToXyz.get(), probeDbl.data(), ref.data(), probeCount);
+        for (size_t i = 0; i < probe.size(); i++) {
+            maxErr = std::max(maxErr, std::fabs(bulkOut[i] - ref[i]));
+        }
+
+        if (d->imgtosrgbBulk) {
+            const IccHandle refToSrgb = iccCache.transform(d->prfIMG, TYPE_RGB_DBL, d->prfRGB, TYPE_RGB_DBL,
+                                                           displayPreviewIntent, cmsFLAGS_NOOPTIMIZE);
+            if (refToSrgb) {
+                cmsDoTransform(d->imgtosrgbBulk.get(), probe.data(), bulkOut.data(), probeCount);
+                cmsDoTransform(refToSrgb.get(), probeDbl.data(), ref.data(), probeCount);
+                for (size_t i = 0; i < probe.size(); i++) {
+                    maxErr = std::max(maxErr, std::fabs(bulkOut[i] - ref[i]));
+                }
+            }
+        }
+        return maxErr;
+    };
+
+    createBulk(0);
+    if (!d->imgtoxyzBulk || !d->imgtoxyz) {
+        return;
     }
 
-    d->xyztosrgb = cmsCreateTransform(d->hsXYZ, TYPE_XYZ_DBL, d->hsRGB, TYPE_RGB_FLT, displayPreviewIntent, 0);
+    const double err = bulkError();
+    qDebug() << "Bulk transform max error:" << err;
+
+    // the optimized pipelines are off for this profile, evaluate it unoptimized instead
+    if (err > bulkTransformTolerance) {
+        qWarning() << "Bulk transform error over tolerance, using unoptimized pipeline";
+        createBulk(cmsFLAGS_NOOPTIMIZE);
+    }
 }
 
 QString ImageParserSC::getProfileName()
@@ -1068,6 +1212,97 @@ QString ImageParserSC::getProfileName()
     return d->m_profileName;
 }
 
+void ImageParserSC::setFloatQuantization(int mantissaBits)
+{
+    d->m_floatMantissaBits = (mantissaBits >= 0 && mantissaBits < QuantizedFloatDedup::fullMantissaBits) ? mantissaBits : -1;
+}
+
+int ImageParserSC::floatQuantization() const
+{
+    return d->m_floatMantissaBits;
+}
+
+void ImageParserSC::setTrimWeighted(bool weighted)
+{
+    d->m_trimWeighted = weighted;
+}
+
+bool ImageParserSC::trimWeighted() const
+{
+    return d->m_trimWeighted;
+}
+
+void ImageParserSC::setTrimSeed(quint64 seed)
+{
+    d->m_trimSeed = seed;
+}
+
+quint64 ImageParserSC::trimSeed() const
+{
+    return d->m_trimSeed;
+}
+
+void ImageParserSC::setSampleSeed(quint64 seed)
+{
+    d->m_sampleSeed = seed;
+}
+
+quint64 ImageParserSC::sampleSeed() const
+{
+    return d->m_sampleSeed;
+}
+
+void ImageParserSC::setXyzLatticeSize(int latticeSize)
+{
+    d->m_xyzLatticeSize = latticeSize > 1 ? latticeSize : 0;
+}
+
+int ImageParserSC::xyzLatticeSize() const
+{
+    return d->m_xyzLatticeSize;
+}
+
+double ImageParserSC::xyzLatticeError() const
+{
+    return d->m_xyzLattice ? d->m_xyzLattice->maxError() : 0.0;
+}
+
+const ProgressToken &ImageParserSC::progress() const
+{
+    return d->m_progress;
+}
+
+void ImageParserSC::cancel()
+{
+    d->m_progress.cancel();
+}
+
+bool ImageParserSC::isCanceled() const
+{
+    return d->m_progress.isCanceled();
+}
+
+QString ImageParserSC::stageName(int stage)
+{
+    switch (stage) {
+    case ParseDedup:
+        return QStringLiteral("Finding duplicate colors...");
+    case ParseConvert:
+        return QStringLiteral("Converting...");
+    case ParseFinalize:
+        return QStringLiteral("Appending...");
+    case ParseGamut:
+        return QStringLiteral("Calculating gamut...");
+    case ParseTrim:
+        return QStringLiteral("Trimming...(2nd pass)");
+    case ParseDone:
+        return QStringLiteral("Done");
+    case ParseIdle:
+    default:
+        return QStringLiteral("Opening image...");
+    }
+}
+
 QString ImageParserSC::getMaxOccurence()
 {
     return d->m_maxOccStr;
@@ -1089,6 +1324,16 @@ QVector<ImageXYZDouble> *ImageParserSC::getOuterGamut() const
     return &d->m_outerGamut;
 }
 
+void ImageParserSC::setGamutResolution(int samplesPerEdge)
+{
+    d->m_gamutResolution = std::max(2, samplesPerEdge);
+}
+
+int ImageParserSC::gamutResolution() const
+{
+    return d->m_gamutResolution;
+}
+
 QVector<QColor> *ImageParserSC::getQColorArray() const
 {
     // deprecated
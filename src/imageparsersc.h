@@ -12,34 +12,95 @@
 #include <QScopedPointer>
 #include <lcms2.h>
 
+#include <functional>
+
+#include "colorpointstore.h"
 #include "imageformats.h"
+#include "parallel_funcs.h"
 #include "plot_typedefs.h"
 
+class PixelFeed;
+
+/*
+ * inputFile() and trimImage() are blocking and don't touch the GUI, run them on
+ * a worker thread and watch progress() from the GUI thread. cancel() can be
+ * called from any thread, it's checked once per chunk of work.
+ */
 class ImageParserSC
 {
 public:
+    enum ParseStage {
+        ParseIdle = 0,
+        ParseDedup,
+        ParseConvert,
+        ParseFinalize,
+        ParseGamut,
+        ParseTrim,
+        ParseDone
+    };
+
     ImageParserSC();
     ~ImageParserSC();
 
-    void inputFile(const QImage &imgIn, int size, QVector<ColorPoint> *outCp);
-    void inputFile(const QByteArray &rawData, const QByteArray &iccData, ImageColorDepthID depthId, QSize imgSize, int size, QVector<ColorPoint> *outCp);
+    void inputFile(const QImage &imgIn, int size, ColorPointStore *outCp);
+    void inputFile(const QByteArray &rawData, const QByteArray &iccData, ImageColorDepthID depthId, QSize imgSize, int size, ColorPointStore *outCp);
+    // For decoders that push pixels from their own threads: decode(feed) runs the whole decode into feed,
+    // channels interleaved samples of depthId per pixel. False when decode() fails.
+    bool inputFeed(const QByteArray &iccData,
+                   ImageColorDepthID depthId,
+                   QSize imgSize,
+                   int channels,
+                   int size,
+                   ColorPointStore *outCp,
+                   const std::function<bool(PixelFeed *)> &decode);
     QString getProfileName();
     QString getMaxOccurence();
     QVector3D getWhitePointXYY();
     QVector<ImageXYZDouble> *getXYYArray() const;
     QVector<ImageXYZDouble> *getOuterGamut() const;
+    // Samples per cube edge of the profile outline, 100 by default. Colorant outlines ignore it.
+    void setGamutResolution(int samplesPerEdge);
+    int gamutResolution() const;
     QVector<QColor> *getQColorArray() const;
     QByteArray *getRawICC() const;
+    // Keeps exactly size points (0 keeps all), picked in one pass with a seeded sampler.
     void trimImage(quint64 size = 0);
+    // Weighted trimming favours colors by their occurrence count, off by default so rare colors stay as likely.
+    void setTrimWeighted(bool weighted);
+    bool trimWeighted() const;
+    // Fixes the trimming seed so the same input gives the same picks, random per parser by default.
+    void setTrimSeed(quint64 seed);
+    quint64 trimSeed() const;
+    // Fixes the seed of the jittered grid that samples images bigger than the requested size, random by default.
+    void setSampleSeed(quint64 seed);
+    quint64 sampleSeed() const;
+
+    // Bucket float colors to this many mantissa bits before dedup, -1 (default) keeps exact colors.
+    void setFloatQuantization(int mantissaBits);
+    int floatQuantization() const;
+
+    // Approximate the XYZ conversion of cLUT profiles with a latticeSize^3 tetrahedral lattice (e.g. 65),
+    // 0 (default) converts every color through lcms. Matrix/TRC profiles never use it.
+    void setXyzLatticeSize(int latticeSize);
+    int xyzLatticeSize() const;
+    // max error of the lattice measured on the last parse, 0 when it wasn't used
+    double xyzLatticeError() const;
 
     bool isMatchSrgb();
 
+    const ProgressToken &progress() const;
+    void cancel();
+    bool isCanceled() const;
+    static QString stageName(int stage);
+
 private:
     template<typename T>
     void calculateFromRaw();
 
     void iccParseWPColorant();
     void iccPutTransforms();
+    template<typename T>
+    void iccPutBulkTransforms();
 
     class Private;
     QScopedPointer<Private> d;
@@ -1,4 +1,6 @@
 #include "jxlreader.h"
+#include "parallel_funcs.h"
+#include "pixelfeed.h"
 
 #include <jxl/decode_cxx.h>
 #include <jxl/resizable_parallel_runner_cxx.h>
@@ -7,6 +9,12 @@
 #include <QDebug>
 #include <QFile>
 #include <QIODevice>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
 
 // Self made jxlart, source:
 // https://jxl-art.surma.technology/?zcode=C89MKclQMDez4PJIzUzPKAEzg5xDFAwNuPyLMlPzShJLMvPzFAy5nDJLUlILgIqBMqEFxYm5BTmpCkZcwYWlqalVqVxcmWkKyQp2QIUKCroK4Qq6IAZQLFzbT9cvHChhAOSDpPwUdC3gbFegaQZcAA
@@ -14,31 +22,80 @@
 // static constexpr char jxlart[] = {"ff0afa2f41918806010050004b38606cb31e2825e145ed837b4824090b004d00"};
 static constexpr char jxlart[] = {"/wr6L0GRiAYBAFAASzhgbLMeKCXhRe2De0gkCQsATQA="};
 
-template<typename T>
-inline void ImageOutCallback(void *opaque, size_t x, size_t y, size_t num_pixels, const void *pixels)
+// the decoder calls these from its worker threads, thread ids are below the init count
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+static void *feedInitCallback(void *initOpaque, size_t numThreads, size_t numPixelsPerThread)
 {
-    QByteArray *op = static_cast<QByteArray *>(opaque);
-    const char *px = static_cast<const char *>(pixels);
-    const auto *pxf = static_cast<const T *>(pixels);
+    Q_UNUSED(numPixelsPerThread)
+    PixelFeed *feed = static_cast<PixelFeed *>(initOpaque);
+    // a null run opaque fails the decode
+    return feed->begin(static_cast<int>(numThreads)) ? feed : nullptr;
+}
 
-    const size_t pixelsize = num_pixels * sizeof(T) * 3;
+static void feedRunCallback(void *runOpaque, size_t threadId, size_t x, size_t y, size_t numPixels, const void *pixels)
+{
+    PixelFeed *feed = static_cast<PixelFeed *>(runOpaque);
+    if (feed->isCanceled()) return;
+    feed->pixels(static_cast<int>(threadId), x, y, numPixels, pixels);
+}
 
-    const QByteArray raw = QByteArray::fromRawData(px, static_cast<qsizetype>(pixelsize));
+static void feedDestroyCallback(void *runOpaque)
+{
+    Q_UNUSED(runOpaque)
+}
+#else
+// no thread ids before 0.7, calls can still come from several threads at once
+struct SerializedFeed {
+    PixelFeed *feed;
+    QMutex mutex;
+};
 
-    op->append(raw);
+static void feedSerializedCallback(void *opaque, size_t x, size_t y, size_t numPixels, const void *pixels)
+{
+    SerializedFeed *serialized = static_cast<SerializedFeed *>(opaque);
+    if (serialized->feed->isCanceled()) return;
+    QMutexLocker locker(&serialized->mutex);
+    serialized->feed->pixels(0, x, y, numPixels, pixels);
 }
+#endif
+
+// input handed to the decoder per call, mapped or read. The decoder returns between
+// chunks, which is where a cancel gets noticed
+static constexpr qint64 inputChunkSize = 4 * 1024 * 1024;
+
+// DC previews keep one pixel per 8x8 block
+static constexpr size_t previewRatio = 8;
 
-inline JxlImageOutCallback generateCallbackWithPolicy(const JxlPixelFormat &d)
+struct PreviewDecimator {
+    uchar *out;
+    size_t outWidth;
+    size_t pixelBytes;
+};
+
+// the flushed DC image is upsampled back to full size, the top left pixel of a block
+// is close enough to its DC. Rows are written by different threads but never overlap
+static void previewDecimateCallback(void *opaque, size_t x, size_t y, size_t numPixels, const void *pixels)
 {
-    switch (d.data_type) {
-    case JXL_TYPE_FLOAT:
-        return &::ImageOutCallback<float>;
-        break;
+    if (y % previewRatio != 0) return;
+    const PreviewDecimator *decimator = static_cast<const PreviewDecimator *>(opaque);
+    const uchar *src = static_cast<const uchar *>(pixels);
+    uchar *dst = decimator->out + ((y / previewRatio) * decimator->outWidth * decimator->pixelBytes);
+    for (size_t px = ((x + previewRatio - 1) / previewRatio) * previewRatio; px < x + numPixels; px += previewRatio) {
+        std::memcpy(dst + ((px / previewRatio) * decimator->pixelBytes), src + ((px - x) * decimator->pixelBytes), decimator->pixelBytes);
+    }
+}
+
+static size_t bytesPerSample(JxlDataType type)
+{
+    switch (type) {
+    case JXL_TYPE_UINT8:
+        return 1;
+    case JXL_TYPE_UINT16:
+    case JXL_TYPE_FLOAT16:
+        return 2;
     default:
-        break;
+        return 4;
     }
-    qDebug() << "error, only float is currently supported";
-    return nullptr;
 }
 
 class Q_DECL_HIDDEN JxlReader::Private
@@ -50,6 +107,13 @@ public:
     QByteArray m_iccProfile{};
     QByteArray m_rawData{};
 
+    // the file stays open (and mapped when it can be) between the header and the pixel pass
+    QFile m_file{};
+    const uchar *m_mapped{nullptr};
+    const ProgressToken *m_token{nullptr};
+    // the built in art
+    QByteArray m_input{};
+
     ImageColorDepthID m_depthID{};
     ImageColorModelID m_colorID{};
 
@@ -57,6 +121,35 @@ public:
     JxlExtraChannelInfo m_extra{};
     JxlPixelFormat m_pixelFormat{};
     JxlFrameHeader m_header{};
+
+    // size of m_rawData, smaller than the image for previews
+    QSize m_outSize{};
+
+    bool openInput()
+    {
+        if (m_filename.isEmpty()) {
+            if (m_input.isEmpty()) {
+                QByteArray hx{jxlart};
+                m_input = QByteArray::fromBase64(hx);
+            }
+            return true;
+        }
+        if (m_file.isOpen()) {
+            return true;
+        }
+
+        m_file.setFileName(m_filename);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Cannot read file!";
+            return false;
+        }
+        // shares the page cache instead of copying the file, and the decoder starts on the first page
+        m_mapped = m_file.map(0, m_file.size());
+        if (!m_mapped) {
+            qDebug() << "Cannot map file, reading in chunks:" << m_file.errorString();
+        }
+        return true;
+    }
 };
 
 JxlReader::JxlReader(const QString &filename)
@@ -72,27 +165,55 @@ JxlReader::~JxlReader()
 
 bool JxlReader::processJxl()
 {
-    const QByteArray data = [&]() {
-        if (!d->m_filename.isEmpty()) {
-            QFile fileIn(d->m_filename);
-            fileIn.open(QIODevice::ReadOnly);
-            if (!fileIn.isReadable()) {
-                qWarning() << "Cannot read file!";
-                fileIn.close();
-                return QByteArray();
-            }
-            QByteArray out = fileIn.readAll();
-            fileIn.close();
-            return out;
-        } else {
-            QByteArray hx{jxlart};
-            return QByteArray::fromBase64(hx);
-        }
-    }();
+    return decode(DecodeFull, nullptr);
+}
+
+bool JxlReader::processHeader()
+{
+    return decode(DecodeHeader, nullptr);
+}
 
-    if (data.isEmpty()) {
+bool JxlReader::processJxl(PixelFeed *feed)
+{
+    return feed && decode(DecodeFull, feed);
+}
+
+bool JxlReader::processPreview()
+{
+    return decode(DecodePreview, nullptr);
+}
+
+bool JxlReader::decode(DecodeMode mode, PixelFeed *feed)
+{
+    if (!d->openInput()) {
+        return false;
+    }
+
+    // the art goes in at once, files in chunks as the decoder asks. Mapped files only
+    // grow the window over the map, a single call would decode the whole frame
+    const bool chunked = !d->m_mapped && d->m_input.isEmpty();
+    QByteArray chunk;
+    const uint8_t *data = nullptr;
+    size_t dataSize = 0;
+    size_t mappedSize = 0;
+    if (d->m_mapped) {
+        mappedSize = static_cast<size_t>(d->m_file.size());
+        data = d->m_mapped;
+        dataSize = std::min(mappedSize, static_cast<size_t>(inputChunkSize));
+    } else if (!chunked) {
+        data = reinterpret_cast<const uint8_t *>(d->m_input.constData());
+        dataSize = static_cast<size_t>(d->m_input.size());
+    } else {
+        d->m_file.seek(0);
+        chunk = d->m_file.read(inputChunkSize);
+        data = reinterpret_cast<const uint8_t *>(chunk.constData());
+        dataSize = static_cast<size_t>(chunk.size());
+    }
+
+    if (dataSize == 0) {
         return false;
     }
+    d->m_rawData.clear();
 
     auto runner = JxlResizableParallelRunnerMake(nullptr);
     auto dec = JxlDecoderMake(nullptr);
@@ -102,8 +223,17 @@ bool JxlReader::processJxl()
         return false;
     }
 
-    if (JXL_DEC_SUCCESS
-        != JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE)) {
+    int events = JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING;
+    if (mode == DecodeFull) {
+        events |= JXL_DEC_FULL_IMAGE;
+    } else if (mode == DecodePreview) {
+        // the full image event is only there for frames without progressive passes
+        events |= JXL_DEC_PREVIEW_IMAGE | JXL_DEC_FULL_IMAGE;
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+        events |= JXL_DEC_FRAME_PROGRESSION;
+#endif
+    }
+    if (JXL_DEC_SUCCESS != JxlDecoderSubscribeEvents(dec.get(), events)) {
         qWarning() << "JxlDecoderSubscribeEvents failed";
         return false;
     }
@@ -113,8 +243,14 @@ bool JxlReader::processJxl()
         return false;
     }
 
-    const auto validation =
-        JxlSignatureCheck(reinterpret_cast<const uint8_t *>(data.constData()), static_cast<size_t>(data.size()));
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+    if (mode == DecodePreview && JXL_DEC_SUCCESS != JxlDecoderSetProgressiveDetail(dec.get(), kDC)) {
+        qWarning() << "JxlDecoderSetProgressiveDetail failed";
+        return false;
+    }
+#endif
+
+    const auto validation = JxlSignatureCheck(data, dataSize);
 
     switch (validation) {
     case JXL_SIG_NOT_ENOUGH_BYTES:
@@ -127,20 +263,35 @@ bool JxlReader::processJxl()
         break;
     }
 
-    if (JXL_DEC_SUCCESS
-        != JxlDecoderSetInput(dec.get(),
-                              reinterpret_cast<const uint8_t *>(data.constData()),
-                              static_cast<size_t>(data.size()))) {
+    if (JXL_DEC_SUCCESS != JxlDecoderSetInput(dec.get(), data, dataSize)) {
         qWarning() << "JxlDecoderSetInput failed";
         return false;
     };
-    JxlDecoderCloseInput(dec.get());
+    // whether everything up to the end of the file has been handed over
+    auto inputDone = [&]() {
+        if (d->m_mapped) {
+            return data + dataSize == d->m_mapped + mappedSize;
+        }
+        return !chunked || d->m_file.atEnd();
+    };
+    if (inputDone()) {
+        JxlDecoderCloseInput(dec.get());
+    }
     if (JXL_DEC_SUCCESS != JxlDecoderSetDecompressBoxes(dec.get(), JXL_TRUE)) {
         qWarning() << "JxlDecoderSetDecompressBoxes failed";
         return false;
     };
 
+#if JPEGXL_NUMERIC_VERSION < JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+    std::unique_ptr<SerializedFeed> serializedFeed;
+#endif
+    PreviewDecimator decimator{nullptr, 0, 0};
+
     for (;;) {
+        if ((d->m_token && d->m_token->isCanceled()) || (feed && feed->isCanceled())) {
+            qWarning() << "Decode canceled";
+            return false;
+        }
         qDebug() << "---";
         JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
         qDebug() << "status:" << Qt::hex << status;
@@ -149,8 +300,28 @@ bool JxlReader::processJxl()
             qWarning() << "Decoder error";
             return false;
         } else if (status == JXL_DEC_NEED_MORE_INPUT) {
-            qWarning() << "Error, already provided all input";
-            return false;
+            if (inputDone()) {
+                qWarning() << "Error, already provided all input";
+                return false;
+            }
+            // keep what the decoder hasn't consumed yet and append the next chunk
+            const size_t remaining = JxlDecoderReleaseInput(dec.get());
+            if (d->m_mapped) {
+                const uint8_t *end = data + dataSize;
+                data = end - remaining;
+                dataSize = remaining + std::min(static_cast<size_t>(d->m_mapped + mappedSize - end), static_cast<size_t>(inputChunkSize));
+            } else {
+                chunk = chunk.right(static_cast<int>(remaining)) + d->m_file.read(inputChunkSize);
+                data = reinterpret_cast<const uint8_t *>(chunk.constData());
+                dataSize = static_cast<size_t>(chunk.size());
+            }
+            if (JXL_DEC_SUCCESS != JxlDecoderSetInput(dec.get(), data, dataSize)) {
+                qWarning() << "JxlDecoderSetInput failed";
+                return false;
+            }
+            if (inputDone()) {
+                JxlDecoderCloseInput(dec.get());
+            }
         } else if (status == JXL_DEC_BASIC_INFO) {
             if (JXL_DEC_SUCCESS != JxlDecoderGetBasicInfo(dec.get(), &d->m_info)) {
                 qWarning() << "JxlDecoderGetBasicInfo failed";
@@ -178,6 +349,15 @@ bool JxlReader::processJxl()
             qDebug() << "Original profile?" << d->m_info.uses_original_profile;
             qDebug() << "Has preview?" << d->m_info.have_preview << d->m_info.preview.xsize << "x" << d->m_info.preview.ysize;
 
+            d->m_outSize = QSize(static_cast<int>(d->m_info.xsize), static_cast<int>(d->m_info.ysize));
+#if JPEGXL_NUMERIC_VERSION < JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+            // no progressive flush, a DC preview would decode the whole frame anyway
+            if (mode == DecodePreview && !d->m_info.have_preview) {
+                qDebug() << "No preview available";
+                return false;
+            }
+#endif
+
             /* Here lies the dreaded crash when building libjxl with Qt's MinGW kit..
              *
              * Some kind of race condition or something got triggered on multithread
@@ -193,8 +373,7 @@ bool JxlReader::processJxl()
             qDebug() << "Threads set:" << numtreads;
             JxlResizableParallelRunnerSetThreads(runner.get(), numtreads);
 
-            // normally, we call this on Krita to preserve original bitdepth
-            /*
+            // decode at the source depth, integer data keeps exact dedup and takes a quarter of the memory
             if (d->m_info.exponent_bits_per_sample != 0) {
                 if (d->m_info.bits_per_sample <= 16) {
                     d->m_pixelFormat.data_type = JXL_TYPE_FLOAT16;
@@ -204,7 +383,7 @@ bool JxlReader::processJxl()
                     d->m_depthID = Float32BitsColorDepthID;
                 } else {
                     qWarning() << "Unsupported JPEG-XL input depth" << d->m_info.bits_per_sample
-                            << d->m_info.exponent_bits_per_sample;
+                               << d->m_info.exponent_bits_per_sample;
                     return false;
                 }
             } else if (d->m_info.bits_per_sample <= 8) {
@@ -215,13 +394,10 @@ bool JxlReader::processJxl()
                 d->m_depthID = Integer16BitsColorDepthID;
             } else {
                 qWarning() << "Unsupported JPEG-XL input depth" << d->m_info.bits_per_sample
-                        << d->m_info.exponent_bits_per_sample;
+                           << d->m_info.exponent_bits_per_sample;
                 return false;
-            } */
-
-            // but here, let's always ask for float output
-            d->m_pixelFormat.data_type = JXL_TYPE_FLOAT;
-            d->m_depthID = Float32BitsColorDepthID;
+            }
+            qDebug() << "Decoding as" << d->m_depthID;
 
             if (d->m_info.num_color_channels == 1) {
                 // Grayscale
@@ -268,15 +444,76 @@ bool JxlReader::processJxl()
                 return false;
             }
             qDebug() << "ICC profile get";
-        } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
-            // callback practice
-            // goes racing with multiple workers... :3
 
-            // const JxlImageOutCallback callback = generateCallbackWithPolicy(d->m_pixelFormat);
-            // if (!callback) return false;
-            // JxlDecoderSetImageOutCallback(dec.get(), &d->m_pixelFormat, callback, &d->m_rawData);
+            if (mode == DecodeHeader) {
+                break;
+            }
+        } else if (status == JXL_DEC_NEED_PREVIEW_OUT_BUFFER) {
+            size_t rawSize = 0;
+            if (JXL_DEC_SUCCESS != JxlDecoderPreviewOutBufferSize(dec.get(), &d->m_pixelFormat, &rawSize)) {
+                qWarning() << "JxlDecoderPreviewOutBufferSize failed";
+                return false;
+            }
+            d->m_rawData.resize(static_cast<int>(rawSize));
+            if (JXL_DEC_SUCCESS
+                != JxlDecoderSetPreviewOutBuffer(dec.get(),
+                                                 &d->m_pixelFormat,
+                                                 reinterpret_cast<uint8_t *>(d->m_rawData.data()),
+                                                 static_cast<size_t>(d->m_rawData.size()))) {
+                qWarning() << "JxlDecoderSetPreviewOutBuffer failed";
+                return false;
+            }
+            d->m_outSize = QSize(static_cast<int>(d->m_info.preview.xsize), static_cast<int>(d->m_info.preview.ysize));
+            qDebug() << "Preview out buffer set";
+        } else if (status == JXL_DEC_PREVIEW_IMAGE) {
+            qDebug() << "Preview image loaded";
+            break;
+        } else if (status == JXL_DEC_NEED_IMAGE_OUT_BUFFER) {
+            if (mode == DecodePreview) {
+                // only the decimated pixels are kept, never a full size buffer
+                const size_t outWidth = (d->m_info.xsize + previewRatio - 1) / previewRatio;
+                const size_t outHeight = (d->m_info.ysize + previewRatio - 1) / previewRatio;
+                decimator.pixelBytes = bytesPerSample(d->m_pixelFormat.data_type) * d->m_pixelFormat.num_channels;
+                decimator.outWidth = outWidth;
+                d->m_rawData.fill(0, static_cast<int>(outWidth * outHeight * decimator.pixelBytes));
+                decimator.out = reinterpret_cast<uchar *>(d->m_rawData.data());
+                if (JXL_DEC_SUCCESS
+                    != JxlDecoderSetImageOutCallback(dec.get(), &d->m_pixelFormat, &previewDecimateCallback, &decimator)) {
+                    qWarning() << "JxlDecoderSetImageOutCallback failed";
+                    return false;
+                }
+                d->m_outSize = QSize(static_cast<int>(outWidth), static_cast<int>(outHeight));
+                qDebug() << "Preview out callback set";
+                continue;
+            }
 
-            // normal buffer
+            if (feed) {
+                // pixels go straight to the feed from the decoder threads, no frame buffer
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+                if (JXL_DEC_SUCCESS
+                    != JxlDecoderSetMultithreadedImageOutCallback(dec.get(),
+                                                                  &d->m_pixelFormat,
+                                                                  &feedInitCallback,
+                                                                  &feedRunCallback,
+                                                                  &feedDestroyCallback,
+                                                                  feed)) {
+                    qWarning() << "JxlDecoderSetMultithreadedImageOutCallback failed";
+                    return false;
+                }
+#else
+                if (!feed->begin(1)) {
+                    return false;
+                }
+                serializedFeed.reset(new SerializedFeed{feed, {}});
+                if (JXL_DEC_SUCCESS
+                    != JxlDecoderSetImageOutCallback(dec.get(), &d->m_pixelFormat, &feedSerializedCallback, serializedFeed.get())) {
+                    qWarning() << "JxlDecoderSetImageOutCallback failed";
+                    return false;
+                }
+#endif
+                qDebug() << "Image out callback set";
+                continue;
+            }
 
             size_t rawSize = 0;
             if (JXL_DEC_SUCCESS != JxlDecoderImageOutBufferSize(dec.get(), &d->m_pixelFormat, &rawSize)) {
@@ -293,8 +530,22 @@ bool JxlReader::processJxl()
                 return false;
             }
             qDebug() << "Image out buffer set";
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+        } else if (status == JXL_DEC_FRAME_PROGRESSION) {
+            // the first pass is the DC, push it out and stop there
+            if (JXL_DEC_SUCCESS != JxlDecoderFlushImage(dec.get())) {
+                qWarning() << "JxlDecoderFlushImage failed";
+                return false;
+            }
+            qDebug() << "DC image flushed, ratio" << JxlDecoderGetIntendedDownsamplingRatio(dec.get());
+            break;
+#endif
         } else if (status == JXL_DEC_FULL_IMAGE) {
             qDebug() << "Full image loaded";
+            if (mode == DecodePreview) {
+                // first frame only
+                break;
+            }
         } else if (status == JXL_DEC_SUCCESS) {
             qDebug() << "JXL decoding success";
             JxlDecoderReleaseInput(dec.get());
@@ -314,6 +565,11 @@ bool JxlReader::processJxl()
     return true;
 }
 
+int JxlReader::getImageChannelCount() const
+{
+    return static_cast<int>(d->m_pixelFormat.num_channels);
+}
+
 QByteArray JxlReader::getRawImage() const
 {
     return d->m_rawData;
@@ -326,10 +582,15 @@ QByteArray JxlReader::getRawICC() const
 
 QSize JxlReader::getImageDimension()
 {
-    return QSize(static_cast<int>(d->m_info.xsize), static_cast<int>(d->m_info.ysize));
+    return d->m_outSize;
 }
 
 ImageColorDepthID JxlReader::getImageColorDepth()
 {
     return d->m_depthID;
 }
+
+void JxlReader::setProgressToken(const ProgressToken *token)
+{
+    d->m_token = token;
+}
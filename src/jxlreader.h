@@ -6,6 +6,9 @@
 
 #include "imageformats.h"
 
+class PixelFeed;
+struct ProgressToken;
+
 class JxlReader
 {
 public:
@@ -13,12 +16,28 @@ public:
     ~JxlReader();
 
     bool processJxl();
+    // basic info and profile only, the getters except getRawImage() are valid afterwards
+    bool processHeader();
+    // decodes into feed from the decoder's threads instead of a frame buffer, getRawImage() stays empty
+    bool processJxl(PixelFeed *feed);
+    // a draft of the first frame, the embedded preview or the 1:8 DC image, into getRawImage()
+    // and getImageDimension(). false when the file has neither (DC needs libjxl 0.7)
+    bool processPreview();
+    // samples per pixel of the decoded pixels, alpha included
+    int getImageChannelCount() const;
     QByteArray getRawImage() const;
     QByteArray getRawICC() const;
     QSize getImageDimension();
+    // the depth the pixels are decoded at, the source depth (8/16 bit or half/float)
     ImageColorDepthID getImageColorDepth();
+    // optional, a canceled token fails the decode at the next input chunk
+    void setProgressToken(const ProgressToken *token);
 
 private:
+    enum DecodeMode { DecodeHeader, DecodeFull, DecodePreview };
+
+    bool decode(DecodeMode mode, PixelFeed *feed);
+
     class Private;
     Private *const d{nullptr};
 };
@@ -9,21 +9,247 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QColorSpace>
+#include <QMutex>
+#include <QMutexLocker>
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+// the compressed stream goes through this much memory on its way to the file
+static constexpr int outputBufferSize = 1024 * 1024;
+
+static JxlPixelFormat pixelFormatFor(QImage::Format format)
+{
+    JxlPixelFormat pixelFormat{};
+    switch (format) {
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        pixelFormat.data_type = JXL_TYPE_UINT8;
+        break;
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+        pixelFormat.data_type = JXL_TYPE_UINT16;
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+        pixelFormat.data_type = JXL_TYPE_FLOAT16;
+        break;
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+        pixelFormat.data_type = JXL_TYPE_FLOAT;
+        break;
+#endif
+    default:
+        pixelFormat.data_type = JXL_TYPE_UINT8;
+        break;
+    }
+    pixelFormat.num_channels = 4;
+    return pixelFormat;
+}
+
+static size_t bytesPerSample(JxlDataType type)
+{
+    switch (type) {
+    case JXL_TYPE_UINT8:
+        return 1;
+    case JXL_TYPE_UINT16:
+    case JXL_TYPE_FLOAT16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 10, 0)
+// tiles for the chunked frame, straight from the image or filled by the producer
+struct TileInput {
+    JxlPixelFormat format{};
+    size_t pixelBytes{0};
+    const QImage *image{nullptr};
+    const JxlWriter::TileProducer *producer{nullptr};
+
+    QMutex mutex;
+    std::unordered_map<const void *, std::unique_ptr<uchar[]>> owned;
+    std::atomic<bool> failed{false};
+
+    const void *keep(std::unique_ptr<uchar[]> buf)
+    {
+        QMutexLocker locker(&mutex);
+        const void *ptr = buf.get();
+        owned.emplace(ptr, std::move(buf));
+        return ptr;
+    }
+
+    void release(const void *buf)
+    {
+        QMutexLocker locker(&mutex);
+        owned.erase(buf);
+    }
+
+    const void *colorTile(size_t x, size_t y, size_t w, size_t h, size_t *rowOffset)
+    {
+        if (image) {
+            *rowOffset = static_cast<size_t>(image->bytesPerLine());
+            return image->constScanLine(static_cast<int>(y)) + (x * pixelBytes);
+        }
+
+        // called from the encoder threads at once, the lock only guards owned
+        const size_t stride = w * pixelBytes;
+        std::unique_ptr<uchar[]> buf(new uchar[stride * h]);
+        const QRect rect(static_cast<int>(x), static_cast<int>(y), static_cast<int>(w), static_cast<int>(h));
+        if (!(*producer)(rect, buf.get(), static_cast<qsizetype>(stride))) {
+            std::memset(buf.get(), 0, stride * h);
+            failed = true;
+        }
+        *rowOffset = stride;
+        return keep(std::move(buf));
+    }
+};
+
+static void tileColorFormat(void *opaque, JxlPixelFormat *format)
+{
+    *format = static_cast<TileInput *>(opaque)->format;
+}
+
+static const void *tileColorData(void *opaque, size_t xpos, size_t ypos, size_t xsize, size_t ysize, size_t *rowOffset)
+{
+    return static_cast<TileInput *>(opaque)->colorTile(xpos, ypos, xsize, ysize, rowOffset);
+}
+
+static void tileExtraFormat(void *opaque, size_t ecIndex, JxlPixelFormat *format)
+{
+    Q_UNUSED(ecIndex)
+    *format = static_cast<TileInput *>(opaque)->format;
+    format->num_channels = 1;
+}
+
+// alpha is the only extra channel and it comes interleaved in the RGBA color tiles,
+// so the encoder never asks for it here
+static const void *
+tileExtraData(void *opaque, size_t ecIndex, size_t xpos, size_t ypos, size_t xsize, size_t ysize, size_t *rowOffset)
+{
+    Q_UNUSED(xpos)
+    Q_UNUSED(ypos)
+    Q_UNUSED(xsize)
+    Q_UNUSED(ysize)
+    qDebug() << "Unexpected request for extra channel" << ecIndex;
+    static_cast<TileInput *>(opaque)->failed = true;
+    *rowOffset = 0;
+    return nullptr;
+}
+
+static void tileRelease(void *opaque, const void *buf)
+{
+    static_cast<TileInput *>(opaque)->release(buf);
+}
+
+// the encoder writes into one fixed buffer that is flushed to the file every time
+struct FileOutput {
+    QFile *file{nullptr};
+    QByteArray buffer;
+    bool failed{false};
+};
+
+static void *outputGetBuffer(void *opaque, size_t *size)
+{
+    FileOutput *output = static_cast<FileOutput *>(opaque);
+    if (output->failed) {
+        return nullptr;
+    }
+    const size_t capacity = static_cast<size_t>(output->buffer.size());
+    *size = (*size == 0) ? capacity : std::min(*size, capacity);
+    return output->buffer.data();
+}
+
+static void outputReleaseBuffer(void *opaque, size_t writtenBytes)
+{
+    FileOutput *output = static_cast<FileOutput *>(opaque);
+    if (writtenBytes > 0
+        && output->file->write(output->buffer.constData(), static_cast<qint64>(writtenBytes))
+            != static_cast<qint64>(writtenBytes)) {
+        output->failed = true;
+    }
+}
+
+// the encoder goes back to fill in the TOC once the sections are written
+static void outputSeek(void *opaque, uint64_t position)
+{
+    FileOutput *output = static_cast<FileOutput *>(opaque);
+    if (!output->file->seek(static_cast<qint64>(position))) {
+        output->failed = true;
+    }
+}
+
+static void outputFinalized(void *opaque, uint64_t finalizedPosition)
+{
+    // written through already, nothing is held back
+    Q_UNUSED(opaque)
+    Q_UNUSED(finalizedPosition)
+}
+#endif
 
 JxlWriter::JxlWriter()
 {
 }
 
+QImage::Format JxlWriter::encodableFormat(QImage::Format format)
+{
+    switch (format) {
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+    case QImage::Format_RGBA32FPx4:
+    case QImage::Format_RGBA32FPx4_Premultiplied:
+#endif
+        return format;
+    default:
+        return QImage::Format_RGBA8888;
+    }
+}
+
 bool JxlWriter::convert(QImage *img, const QString &filename, const int encEffort)
 {
-    if (img->format() == QImage::Format_ARGB32 || img->format() == QImage::Format_ARGB32_Premultiplied
-        || img->format() == QImage::Format_RGB32 || img->format() == QImage::Format_BGR888) {
-        img->convertTo(QImage::Format_RGBA8888);
+    const QImage::Format format = encodableFormat(img->format());
+    if (img->format() != format) {
+        img->convertTo(format);
+    }
+
+    return encode(img->size(), format, img, nullptr, filename, encEffort);
+}
+
+bool JxlWriter::convert(const QSize &size,
+                        QImage::Format format,
+                        const TileProducer &producer,
+                        const QString &filename,
+                        const int encEffort)
+{
+    if (encodableFormat(format) != format) {
+        qDebug() << "Producer format" << format << "cannot be encoded";
+        return false;
     }
 
-    const QRect bounds = img->rect();
+    return encode(size, format, nullptr, &producer, filename, encEffort);
+}
+
+bool JxlWriter::encode(const QSize &size,
+                       QImage::Format format,
+                       const QImage *img,
+                       const TileProducer *producer,
+                       const QString &filename,
+                       int encEffort)
+{
+    const QRect bounds(QPoint(0, 0), size);
+    if (bounds.isEmpty()) {
+        return false;
+    }
 
     auto enc = JxlEncoderMake(nullptr);
     auto runner = JxlResizableParallelRunnerMake(nullptr);
@@ -37,36 +263,8 @@ bool JxlWriter::convert(QImage *img, const QString &filename, const int encEffor
         JxlResizableParallelRunnerSuggestThreads(static_cast<uint64_t>(bounds.width()),
                                                  static_cast<uint64_t>(bounds.height())));
 
-    const JxlPixelFormat pixelFormat = [&]() {
-        JxlPixelFormat pixelFormat{};
-        switch (img->format()) {
-        case QImage::Format_RGBA8888:
-        case QImage::Format_RGBA8888_Premultiplied:
-        case QImage::Format_ARGB32:
-        case QImage::Format_ARGB32_Premultiplied:
-            pixelFormat.data_type = JXL_TYPE_UINT8;
-            break;
-        case QImage::Format_RGBA64:
-        case QImage::Format_RGBA64_Premultiplied:
-            pixelFormat.data_type = JXL_TYPE_UINT16;
-            break;
-#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
-        case QImage::Format_RGBA16FPx4:
-        case QImage::Format_RGBA16FPx4_Premultiplied:
-            pixelFormat.data_type = JXL_TYPE_FLOAT16;
-            break;
-        case QImage::Format_RGBA32FPx4:
-        case QImage::Format_RGBA32FPx4_Premultiplied:
-            pixelFormat.data_type = JXL_TYPE_FLOAT;
-            break;
-#endif
-        default:
-            pixelFormat.data_type = JXL_TYPE_UINT8;
-            break;
-        }
-        pixelFormat.num_channels = 4;
-        return pixelFormat;
-    }();
+    const JxlPixelFormat pixelFormat = pixelFormatFor(format);
+    const size_t pixelBytes = bytesPerSample(pixelFormat.data_type) * pixelFormat.num_channels;
 
     const auto basicInfo = [&]() {
         auto info{std::make_unique<JxlBasicInfo>()};
@@ -112,11 +310,9 @@ bool JxlWriter::convert(QImage *img, const QString &filename, const int encEffor
 
     JxlColorEncoding cicpDescription{};
     {
-        switch (img->format()) {
+        switch (format) {
         case QImage::Format_RGBA8888:
         case QImage::Format_RGBA8888_Premultiplied:
-        case QImage::Format_ARGB32:
-        case QImage::Format_ARGB32_Premultiplied:
         case QImage::Format_RGBA64:
         case QImage::Format_RGBA64_Premultiplied:
             cicpDescription.transfer_function = JXL_TRANSFER_FUNCTION_SRGB;
@@ -165,7 +361,7 @@ bool JxlWriter::convert(QImage *img, const QString &filename, const int encEffor
         };
 
         const int effort = [&]() {
-            const quint64 imgPxSize = bounds.width() * bounds.height();
+            const quint64 imgPxSize = static_cast<quint64>(bounds.width()) * bounds.height();
             if (encEffort > 0) return std::min(std::max(encEffort, 1), 9);
 #if JPEGXL_NUMERIC_VERSION > JPEGXL_COMPUTE_NUMERIC_VERSION(0, 10, 0)
             return 7;
@@ -196,45 +392,107 @@ bool JxlWriter::convert(QImage *img, const QString &filename, const int encEffor
         }
     }
 
-    if (JxlEncoderAddImageFrame(frameSettings,
-                                &pixelFormat,
-                                img->constBits(),
-                                static_cast<size_t>(img->sizeInBytes()))
-        != JXL_ENC_SUCCESS) {
-        qDebug() << "JxlEncoderAddImageFrame failed";
+    QFile outF(filename);
+    outF.open(QIODevice::WriteOnly);
+    if (!outF.isWritable()) {
+        qDebug() << "Cannot write to file";
+        outF.close();
+        return false;
+    }
+
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 10, 0)
+    // output goes to the file as it is produced and the frame is pulled a tile at a time,
+    // neither the whole frame nor the whole stream is ever copied
+    FileOutput output;
+    output.file = &outF;
+    output.buffer = QByteArray(outputBufferSize, 0x0);
+
+    JxlEncoderOutputProcessor processor{};
+    processor.opaque = &output;
+    processor.get_buffer = &outputGetBuffer;
+    processor.release_buffer = &outputReleaseBuffer;
+    processor.seek = &outputSeek;
+    processor.set_finalized_position = &outputFinalized;
+    if (JXL_ENC_SUCCESS != JxlEncoderSetOutputProcessor(enc.get(), processor)) {
+        qDebug() << "JxlEncoderSetOutputProcessor failed";
+        outF.close();
+        return false;
+    }
+
+    TileInput input;
+    input.format = pixelFormat;
+    input.pixelBytes = pixelBytes;
+    input.image = img;
+    input.producer = producer;
+
+    JxlChunkedFrameInputSource source{};
+    source.opaque = &input;
+    source.get_color_channels_pixel_format = &tileColorFormat;
+    source.get_color_channel_data_at = &tileColorData;
+    source.get_extra_channel_pixel_format = &tileExtraFormat;
+    source.get_extra_channel_data_at = &tileExtraData;
+    source.release_buffer = &tileRelease;
+
+    if (JXL_ENC_SUCCESS != JxlEncoderAddChunkedFrame(frameSettings, JXL_TRUE, source)) {
+        qDebug() << "JxlEncoderAddChunkedFrame failed";
+        outF.close();
         return false;
     }
 
     JxlEncoderCloseInput(enc.get());
 
-    QFile outF(filename);
-    outF.open(QIODevice::WriteOnly);
-    if (!outF.isWritable()) {
-        qDebug() << "Cannot write to file";
+    if (JXL_ENC_SUCCESS != JxlEncoderFlushInput(enc.get()) || output.failed || input.failed) {
+        qDebug() << "JxlEncoderFlushInput failed";
+        outF.close();
+        return false;
+    }
+#else
+    // no chunked frames before 0.10, producers fill a whole frame first, in strips of about 16 MiB
+    QByteArray frame;
+    if (!img) {
+        constexpr qsizetype gatherStripBytes = 16 * 1024 * 1024;
+        const qsizetype stride = static_cast<qsizetype>(bounds.width()) * static_cast<qsizetype>(pixelBytes);
+        const int stripRows = static_cast<int>(std::max<qsizetype>(1, gatherStripBytes / stride));
+        frame.resize(stride * bounds.height());
+        for (int y = 0; y < bounds.height(); y += stripRows) {
+            const QRect strip(0, y, bounds.width(), std::min(stripRows, bounds.height() - y));
+            if (!(*producer)(strip, reinterpret_cast<uchar *>(frame.data()) + (stride * y), stride)) {
+                qDebug() << "Tile producer failed";
+                outF.close();
+                return false;
+            }
+        }
+    }
+
+    if (JxlEncoderAddImageFrame(frameSettings,
+                                &pixelFormat,
+                                img ? static_cast<const void *>(img->constBits()) : frame.constData(),
+                                img ? static_cast<size_t>(img->sizeInBytes()) : static_cast<size_t>(frame.size()))
+        != JXL_ENC_SUCCESS) {
+        qDebug() << "JxlEncoderAddImageFrame failed";
         outF.close();
         return false;
     }
 
-    QByteArray compressed(16384, 0x0);
-    auto *nextOut = reinterpret_cast<uint8_t *>(compressed.data());
-    auto availOut = static_cast<size_t>(compressed.size());
+    JxlEncoderCloseInput(enc.get());
+
+    // one fixed buffer, written out every round instead of growing it for the whole stream
+    QByteArray compressed(outputBufferSize, 0x0);
     auto result = JXL_ENC_NEED_MORE_OUTPUT;
     while (result == JXL_ENC_NEED_MORE_OUTPUT) {
+        auto *nextOut = reinterpret_cast<uint8_t *>(compressed.data());
+        auto availOut = static_cast<size_t>(compressed.size());
         result = JxlEncoderProcessOutput(enc.get(), &nextOut, &availOut);
         if (result != JXL_ENC_ERROR) {
             outF.write(compressed.data(), compressed.size() - static_cast<int>(availOut));
         }
-        if (result == JXL_ENC_NEED_MORE_OUTPUT) {
-            compressed.resize(compressed.size() * 2);
-            nextOut = reinterpret_cast<uint8_t *>(compressed.data());
-            availOut = static_cast<size_t>(compressed.size());
-        }
     }
     if (JXL_ENC_SUCCESS != result) {
         qDebug() << "JxlEncoderProcessOutput failed";
         outF.close();
         return false;
     }
+#endif
     outF.close();
 
     return true;
@@ -3,12 +3,36 @@
 
 #include <QImage>
 
+#include <functional>
+
 class JxlWriter
 {
 public:
+    // fills dst with the pixels of rect, rect.height() rows stride bytes apart in the format given to convert().
+    // Has to be reentrant, the encoder threads ask for different rects at the same time
+    using TileProducer = std::function<bool(const QRect &rect, uchar *dst, qsizetype stride)>;
+
     JxlWriter();
 
     bool convert(QImage *img, const QString &filename, const int encEffort = -1);
+    // pulls the frame from producer while encoding, only the tiles in flight are kept around
+    // (libjxl 0.10+, older versions gather the whole frame first). format has to be encodable
+    bool convert(const QSize &size,
+                 QImage::Format format,
+                 const TileProducer &producer,
+                 const QString &filename,
+                 const int encEffort = -1);
+
+    // the RGBA format images of format have to be converted to before encoding
+    static QImage::Format encodableFormat(QImage::Format format);
+
+private:
+    bool encode(const QSize &size,
+                QImage::Format format,
+                const QImage *img,
+                const TileProducer *producer,
+                const QString &filename,
+                int encEffort);
 };
 
 #endif // JXLWRITER_H
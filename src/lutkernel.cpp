@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#include "lutkernel.h"
+#include "parallel_funcs.h"
+
+#include <QDebug>
+
+#include <cmath>
+
+bool TetrahedralLutKernel::build(const IccHandle &referenceToXyz, int latticeSize)
+{
+    m_lattice.clear();
+    m_maxError = 0.0;
+    m_size = 0;
+    m_reference = referenceToXyz;
+
+    if (!m_reference || latticeSize < 2) {
+        return false;
+    }
+
+    const int n = latticeSize;
+    const quint64 points = static_cast<quint64>(n) * n * n;
+    const double step = 1.0 / (n - 1);
+
+    std::vector<float> lattice(points * 3);
+
+    // one transform call per red slice
+    const int workers = suggestedWorkers(n, 1);
+    parallelForWorkers(workers, [&](int worker) {
+        std::vector<double> in(static_cast<size_t>(n) * n * 3);
+        std::vector<double> out(in.size());
+        const int end = static_cast<int>(workerRangeEnd(n, workers, worker));
+        for (int r = static_cast<int>(workerRangeBegin(n, workers, worker)); r < end; r++) {
+            size_t p = 0;
+            for (int g = 0; g < n; g++) {
+                for (int b = 0; b < n; b++) {
+                    in[p++] = r * step;
+                    in[p++] = g * step;
+                    in[p++] = b * step;
+                }
+            }
+            cmsDoTransform(m_reference.get(), in.data(), out.data(), static_cast<cmsUInt32Number>(n) * n);
+            std::copy(out.begin(), out.end(), lattice.begin() + (static_cast<size_t>(r) * n * n * 3));
+        }
+    });
+
+    m_lattice.swap(lattice);
+    m_size = n;
+
+    // worst case is in the middle of the cells, measure there on up to 32^3 of them
+    const int cellStride = std::max(1, (n + 30) / 32);
+    std::vector<double> probe;
+    for (int r = 0; r < n - 1; r += cellStride) {
+        for (int g = 0; g < n - 1; g += cellStride) {
+            for (int b = 0; b < n - 1; b += cellStride) {
+                probe.push_back((r + 0.5) * step);
+                probe.push_back((g + 0.5) * step);
+                probe.push_back((b + 0.5) * step);
+            }
+        }
+    }
+    const cmsUInt32Number count = probe.size() / 3;
+    std::vector<double> ref(probe.size());
+    cmsDoTransform(m_reference.get(), probe.data(), ref.data(), count);
+
+    for (cmsUInt32Number i = 0; i < count; i++) {
+        float out[3];
+        interpolate(static_cast<float>(probe[(i * 3)]),
+                    static_cast<float>(probe[(i * 3) + 1]),
+                    static_cast<float>(probe[(i * 3) + 2]),
+                    out);
+        for (int c = 0; c < 3; c++) {
+            m_maxError = std::max(m_maxError, std::fabs(out[c] - ref[(i * 3) + c]));
+        }
+    }
+    qDebug() << "XYZ lattice" << n << "max error:" << m_maxError;
+
+    return true;
+}
+
+void TetrahedralLutKernel::reference(float r, float g, float b, float *out) const
+{
+    const double in[3] = {r, g, b};
+    double res[3];
+    cmsDoTransform(m_reference.get(), in, res, 1);
+    out[0] = static_cast<float>(res[0]);
+    out[1] = static_cast<float>(res[1]);
+    out[2] = static_cast<float>(res[2]);
+}
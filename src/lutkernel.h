@@ -0,0 +1,145 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef LUTKERNEL_H
+#define LUTKERNEL_H
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include <lcms2.h>
+
+#include "icctransformcache.h"
+
+/*
+ * RGB to XYZ through a sampled 3D lattice
+ *
+ * For cLUT profiles there is no matrix shortcut, so the reference transform is
+ * sampled once on a latticeSize^3 grid over [0, 1] and every color after that
+ * is a tetrahedral interpolation of the 4 nearest lattice points. This is an
+ * approximation, build() measures the max error between the lattice cells so
+ * it can be reported. Float input outside of [0, 1] goes through the
+ * reference transform.
+ */
+class TetrahedralLutKernel
+{
+public:
+    // reference must take TYPE_RGB_DBL and give TYPE_XYZ_DBL
+    bool build(const IccHandle &referenceToXyz, int latticeSize);
+
+    bool isValid() const
+    {
+        return !m_lattice.empty();
+    }
+
+    int latticeSize() const
+    {
+        return m_size;
+    }
+
+    double maxError() const
+    {
+        return m_maxError;
+    }
+
+    template<typename T>
+    void toXyz(const T *rgb, float *xyz, quint64 count) const
+    {
+        for (quint64 i = 0; i < count; i++) {
+            const float r = normalized(rgb[(i * 3)]);
+            const float g = normalized(rgb[(i * 3) + 1]);
+            const float b = normalized(rgb[(i * 3) + 2]);
+            if (r >= 0.0f && r <= 1.0f && g >= 0.0f && g <= 1.0f && b >= 0.0f && b <= 1.0f) {
+                interpolate(r, g, b, xyz + (i * 3));
+            } else {
+                reference(r, g, b, xyz + (i * 3));
+            }
+        }
+    }
+
+private:
+    template<typename T, typename std::enable_if_t<std::numeric_limits<T>::is_integer, int> = 1>
+    static inline float normalized(const T v)
+    {
+        return static_cast<float>(v) / static_cast<float>(std::numeric_limits<T>::max());
+    }
+
+    static inline float normalized(const float v)
+    {
+        return v;
+    }
+
+    inline void interpolate(float r, float g, float b, float *out) const
+    {
+        const float scale = static_cast<float>(m_size - 1);
+        float fr = r * scale;
+        float fg = g * scale;
+        float fb = b * scale;
+        const int ir = std::min(static_cast<int>(fr), m_size - 2);
+        const int ig = std::min(static_cast<int>(fg), m_size - 2);
+        const int ib = std::min(static_cast<int>(fb), m_size - 2);
+        fr -= ir;
+        fg -= ig;
+        fb -= ib;
+
+        const int sR = m_size * m_size * 3;
+        const int sG = m_size * 3;
+        const int sB = 3;
+        const float *c000 = m_lattice.data() + (ir * sR) + (ig * sG) + (ib * sB);
+        const float *c111 = c000 + sR + sG + sB;
+
+        // walk from c000 to c111 along the edges of the tetrahedron that holds the point
+        const float *p1;
+        const float *p2;
+        float w1, w2, w3;
+        if (fr >= fg) {
+            if (fg >= fb) {
+                p1 = c000 + sR;
+                p2 = c000 + sR + sG;
+                w1 = fr, w2 = fg, w3 = fb;
+            } else if (fr >= fb) {
+                p1 = c000 + sR;
+                p2 = c000 + sR + sB;
+                w1 = fr, w2 = fb, w3 = fg;
+            } else {
+                p1 = c000 + sB;
+                p2 = c000 + sR + sB;
+                w1 = fb, w2 = fr, w3 = fg;
+            }
+        } else {
+            if (fb >= fg) {
+                p1 = c000 + sB;
+                p2 = c000 + sG + sB;
+                w1 = fb, w2 = fg, w3 = fr;
+            } else if (fb >= fr) {
+                p1 = c000 + sG;
+                p2 = c000 + sG + sB;
+                w1 = fg, w2 = fb, w3 = fr;
+            } else {
+                p1 = c000 + sG;
+                p2 = c000 + sR + sG;
+                w1 = fg, w2 = fr, w3 = fb;
+            }
+        }
+
+        for (int c = 0; c < 3; c++) {
+            out[c] = c000[c] + (w1 * (p1[c] - c000[c])) + (w2 * (p2[c] - p1[c])) + (w3 * (c111[c] - p2[c]));
+        }
+    }
+
+    void reference(float r, float g, float b, float *out) const;
+
+    IccHandle m_reference;
+    std::vector<float> m_lattice;
+    int m_size{0};
+    double m_maxError{0.0};
+};
+
+#endif // LUTKERNEL_H
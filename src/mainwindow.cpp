@@ -25,9 +25,6 @@
 #include <jxl/version.h>
 #endif
 
-bool ClampNegative = false;
-bool ClampPositive = false;
-
 class Q_DECL_HIDDEN MainWindow::Private
 {
 public:
@@ -229,6 +226,13 @@ void MainWindow::goPlot()
         scd->overrideSettings(plotSet);
     }
 
+    PlotSettingParser parserSet;
+    parserSet.gamutResolution = gamutResSpn->value();
+    parserSet.xyzLatticeSize = latticeSizeSpn->value();
+    parserSet.floatMantissaBits = floatQuantSpn->value();
+    parserSet.trimSeed = static_cast<quint64>(trimSeedSpn->value());
+    scd->overrideParserSettings(parserSet);
+
     if (!scd->startParse()) {
         scd->deleteLater();
         plotBtn->setEnabled(true);
@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#include "matrixshaper.h"
+
+#include <QDebug>
+
+#include <cmath>
+
+bool MatrixShaperKernel::build(cmsHPROFILE profile, cmsHTRANSFORM referenceToXyz, int lutSize, double tolerance)
+{
+    m_valid = false;
+    m_maxError = 0.0;
+
+    if (!profile || !referenceToXyz || lutSize < 2) {
+        return false;
+    }
+    if (cmsGetColorSpace(profile) != cmsSigRgbData || !cmsIsMatrixShaper(profile)) {
+        return false;
+    }
+
+    const cmsTagSignature trcTags[3] = {cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag};
+    for (int c = 0; c < 3; c++) {
+        const cmsToneCurve *trc = static_cast<const cmsToneCurve *>(cmsReadTag(profile, trcTags[c]));
+        if (!trc) {
+            return false;
+        }
+        m_curves[c] = std::shared_ptr<cmsToneCurve>(cmsDupToneCurve(trc), [](cmsToneCurve *p) {
+            cmsFreeToneCurve(p);
+        });
+        if (!m_curves[c]) {
+            return false;
+        }
+    }
+
+    m_lutSize = lutSize;
+    for (int c = 0; c < 3; c++) {
+        m_lut[c].resize(lutSize);
+        for (int i = 0; i < lutSize; i++) {
+            m_lut[c][i] = cmsEvalToneCurveFloat(m_curves[c].get(), static_cast<float>(i) / static_cast<float>(lutSize - 1));
+        }
+    }
+
+    // the columns are the primaries as the reference sees them, so the matrix
+    // includes whatever white point handling the reference does
+    for (int c = 0; c < 3; c++) {
+        double rgb[3] = {0.0, 0.0, 0.0};
+        rgb[c] = 1.0;
+        double xyz[3];
+        cmsDoTransform(referenceToXyz, rgb, xyz, 1);
+
+        const double peak = m_lut[c][lutSize - 1];
+        if (!(std::fabs(peak) > 1e-6)) {
+            return false;
+        }
+        for (int r = 0; r < 3; r++) {
+            m_matrix[(r * 3) + c] = static_cast<float>(xyz[r] / peak);
+        }
+    }
+
+    // check the whole kernel against the reference on a coarse grid
+    const int steps = 13;
+    std::vector<float> probe;
+    std::vector<double> probeDbl;
+    for (int r = 0; r < steps; r++) {
+        for (int g = 0; g < steps; g++) {
+            for (int b = 0; b < steps; b++) {
+                for (const int c : {r, g, b}) {
+                    const float v = static_cast<float>(c) / (steps - 1.0f);
+                    probe.push_back(v);
+                    probeDbl.push_back(v);
+                }
+            }
+        }
+    }
+    const quint64 count = probe.size() / 3;
+    std::vector<float> out(probe.size());
+    std::vector<double> ref(probe.size());
+    toXyz(probe.data(), out.data(), count);
+    cmsDoTransform(referenceToXyz, probeDbl.data(), ref.data(), static_cast<cmsUInt32Number>(count));
+
+    for (size_t i = 0; i < probe.size(); i++) {
+        m_maxError = std::max(m_maxError, std::fabs(out[i] - ref[i]));
+    }
+    qDebug() << "Matrix shaper max error:" << m_maxError;
+
+    m_valid = (m_maxError <= tolerance);
+    return m_valid;
+}
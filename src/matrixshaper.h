@@ -0,0 +1,185 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef MATRIXSHAPER_H
+#define MATRIXSHAPER_H
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <lcms2.h>
+
+/*
+ * RGB to XYZ for matrix/TRC profiles without going through lcms
+ *
+ * Every channel goes through a lookup table of its TRC, then through the 3x3
+ * matrix. Pixels are processed in fixed batches of planar arrays, and each
+ * stage is a plain loop over one of them: integer input gathers from the table
+ * directly, float input is clamped and interpolated without branches, and only
+ * batches with values outside of [0, 1] get a second pass that evaluates the
+ * curve itself for those. Which path a call takes is decided once, not per
+ * pixel, so the interpolation and the matrix loops can vectorize.
+ *
+ * build() derives the matrix from the reference transform and checks the whole
+ * kernel against it, so when it returns true the kernel is a drop in
+ * replacement for that transform. Anything that's not a matrix shaper
+ * (LUT based profiles) stays on lcms.
+ */
+class MatrixShaperKernel
+{
+public:
+    // lutSize should be 256 / 65536 for 8 / 16 bit input so those index the table directly
+    bool build(cmsHPROFILE profile, cmsHTRANSFORM referenceToXyz, int lutSize, double tolerance);
+
+    bool isValid() const
+    {
+        return m_valid;
+    }
+
+    double maxError() const
+    {
+        return m_maxError;
+    }
+
+    template<typename T>
+    void toXyz(const T *rgb, float *xyz, quint64 count) const
+    {
+        float in[3][batchSize];
+        float lin[3][batchSize];
+        float out[3][batchSize];
+        int index[batchSize];
+        float frac[batchSize];
+
+        // integer input at the table size indexes it directly, decided once for the whole call
+        const bool direct = [&]() {
+            if constexpr (std::numeric_limits<T>::is_integer) {
+                return m_lutSize == static_cast<int>(std::numeric_limits<T>::max()) + 1;
+            } else {
+                return false;
+            }
+        }();
+        const float scale = static_cast<float>(m_lutSize - 1);
+        const qint32 oneBits = floatBits(1.0f);
+
+        for (quint64 base = 0; base < count; base += batchSize) {
+            const int n = static_cast<int>(std::min<quint64>(batchSize, count - base));
+            const T *src = rgb + (base * 3);
+            float *dst = xyz + (base * 3);
+
+            if (direct) {
+                for (int c = 0; c < 3; c++) {
+                    const float *lut = m_lut[c].data();
+                    for (int i = 0; i < n; i++) {
+                        lin[c][i] = lut[lutIndex(src[(i * 3) + c])];
+                    }
+                }
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    for (int i = 0; i < n; i++) {
+                        in[c][i] = normalized(src[(i * 3) + c]);
+                    }
+                }
+                // clamped on the bits: as integers, negative floats (-0 too) sort below the
+                // bits of 0 and NaN above those of 1, so no float compare keeps the loop scalar
+                qint32 outside = 0;
+                for (int c = 0; c < 3; c++) {
+                    for (int i = 0; i < n; i++) {
+                        const qint32 raw = floatBits(in[c][i]);
+                        const qint32 bits = std::min(std::max(raw, 0), oneBits);
+                        outside |= raw ^ bits;
+                        const float pos = bitsFloat(bits) * scale;
+                        index[i] = std::min(static_cast<int>(pos), m_lutSize - 2);
+                        frac[i] = pos - static_cast<float>(index[i]);
+                    }
+                    const float *lut = m_lut[c].data();
+                    for (int i = 0; i < n; i++) {
+                        const int j = index[i];
+                        lin[c][i] = lut[j] + ((lut[j + 1] - lut[j]) * frac[i]);
+                    }
+                }
+                // extended values are rare, only those batches evaluate the curves themselves
+                if (outside != 0) {
+                    for (int c = 0; c < 3; c++) {
+                        for (int i = 0; i < n; i++) {
+                            const qint32 raw = floatBits(in[c][i]);
+                            if (raw < 0 || raw > oneBits) {
+                                lin[c][i] = cmsEvalToneCurveFloat(m_curves[c].get(), in[c][i]);
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (int r = 0; r < 3; r++) {
+                const float m0 = m_matrix[(r * 3)];
+                const float m1 = m_matrix[(r * 3) + 1];
+                const float m2 = m_matrix[(r * 3) + 2];
+                for (int i = 0; i < n; i++) {
+                    out[r][i] = (m0 * lin[0][i]) + (m1 * lin[1][i]) + (m2 * lin[2][i]);
+                }
+            }
+
+            for (int i = 0; i < n; i++) {
+                dst[(i * 3)] = out[0][i];
+                dst[(i * 3) + 1] = out[1][i];
+                dst[(i * 3) + 2] = out[2][i];
+            }
+        }
+    }
+
+private:
+    static constexpr int batchSize = 256;
+
+    template<typename T>
+    static inline float normalized(const T v)
+    {
+        if constexpr (std::numeric_limits<T>::is_integer) {
+            return static_cast<float>(v) / static_cast<float>(std::numeric_limits<T>::max());
+        } else {
+            return static_cast<float>(v);
+        }
+    }
+
+    static inline qint32 floatBits(const float v)
+    {
+        qint32 bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        return bits;
+    }
+
+    static inline float bitsFloat(const qint32 bits)
+    {
+        float v;
+        std::memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    // only reached for integer input, the float overload keeps the template valid
+    template<typename T>
+    static inline int lutIndex(const T v)
+    {
+        if constexpr (std::numeric_limits<T>::is_integer) {
+            return static_cast<int>(v);
+        } else {
+            return 0;
+        }
+    }
+
+    std::shared_ptr<cmsToneCurve> m_curves[3];
+    std::vector<float> m_lut[3];
+    float m_matrix[9]{};
+    int m_lutSize{0};
+    double m_maxError{0.0};
+    bool m_valid{false};
+};
+
+#endif // MATRIXSHAPER_H
@@ -0,0 +1,109 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef PARALLEL_FUNCS_H
+#define PARALLEL_FUNCS_H
+
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+
+/*
+ * Progress and cancel state shared between a job running on a worker thread
+ * and whoever watches it. Everything is atomic, the job bumps value and checks
+ * isCanceled() once per chunk, the watcher polls and may call cancel().
+ */
+struct ProgressToken {
+    std::atomic<int> stage{0};
+    std::atomic<quint64> value{0};
+    std::atomic<quint64> maximum{0};
+    std::atomic<bool> canceled{false};
+
+    void setStage(int newStage, quint64 newMaximum)
+    {
+        value.store(0, std::memory_order_relaxed);
+        maximum.store(newMaximum, std::memory_order_relaxed);
+        stage.store(newStage, std::memory_order_release);
+    }
+
+    void advance(quint64 n)
+    {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void cancel()
+    {
+        canceled.store(true, std::memory_order_relaxed);
+    }
+
+    bool isCanceled() const
+    {
+        return canceled.load(std::memory_order_relaxed);
+    }
+};
+
+// Worker count for a job of itemCount items, never spawn a worker for less than minPerWorker items.
+inline int suggestedWorkers(quint64 itemCount, quint64 minPerWorker = 65536)
+{
+    const quint64 ideal = static_cast<quint64>(std::max(1, QThread::idealThreadCount()));
+    const quint64 bySize = std::max<quint64>(1, itemCount / std::max<quint64>(1, minPerWorker));
+    return static_cast<int>(std::min(ideal, bySize));
+}
+
+// Chunk length for a job split into chunksPerThread chunks per core, never shorter than minChunk.
+inline quint64 suggestedChunkSize(quint64 itemCount, quint64 minChunk = 4096, int chunksPerThread = 4)
+{
+    const quint64 chunks = static_cast<quint64>(std::max(1, QThread::idealThreadCount()) * std::max(1, chunksPerThread));
+    return std::max<quint64>(std::max<quint64>(1, minChunk), (itemCount + chunks - 1) / chunks);
+}
+
+// Calls fn(worker) once for every worker in [0, workers), blocks until all are done.
+template<typename Fn>
+inline void parallelForWorkers(int workers, Fn fn)
+{
+    if (workers <= 1) {
+        fn(0);
+        return;
+    }
+    QVector<int> ids(workers);
+    std::iota(ids.begin(), ids.end(), 0);
+    QtConcurrent::blockingMap(ids, [&](const int &id) {
+        fn(id);
+    });
+}
+
+// Splits [0, count) into one contiguous range per worker.
+inline quint64 workerRangeBegin(quint64 count, int workers, int worker)
+{
+    return (count / workers) * worker + std::min<quint64>(worker, count % workers);
+}
+
+inline quint64 workerRangeEnd(quint64 count, int workers, int worker)
+{
+    return workerRangeBegin(count, workers, worker + 1);
+}
+
+// Counter based random numbers (splitmix64): the value for an index only depends on
+// the seed and the index, so parallel jobs give the same result for any worker count.
+inline quint64 counterRandom(quint64 seed, quint64 index)
+{
+    quint64 z = seed + ((index + 1) * 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in (0, 1), never exactly 0 so it's safe to take the log of.
+inline double counterRandomUnit(quint64 seed, quint64 index)
+{
+    return (static_cast<double>(counterRandom(seed, index) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+#endif // PARALLEL_FUNCS_H
@@ -0,0 +1,180 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef PIXEL_SAMPLER_H
+#define PIXEL_SAMPLER_H
+
+#include <QtGlobal>
+
+#include <algorithm>
+
+#include "parallel_funcs.h"
+
+/*
+ * Jittered grid pixel sampler
+ *
+ * Splits the image into cellsX * cellsY cells (the size the image would be
+ * downscaled to) and picks one random pixel inside every cell. Cells don't
+ * overlap, so no pixel is picked twice, and the picks are spread over the whole
+ * image without the clumps and holes of plain random sampling.
+ *
+ * Nothing is copied: the dedup engines ask pixelIndex() for the offset of a
+ * sample in the original buffer. The pick of a cell only depends on the seed
+ * and the cell index, so it's the same for any worker count or strip size.
+ *
+ * A window restricts the samples to the cells of a strip of rows, for buffers
+ * that only hold part of the image. Strips have to start and end on cell row
+ * boundaries, see alignRow().
+ */
+class StratifiedPixelSampler
+{
+public:
+    // samples at most maxLongSide cells along the long side, inactive when the image already fits
+    void reset(int width, int height, int maxLongSide, quint64 seed)
+    {
+        m_width = std::max(0, width);
+        m_height = std::max(0, height);
+        m_seed = seed;
+
+        const int longSide = std::max(m_width, m_height);
+        if (maxLongSide <= 0 || longSide <= maxLongSide) {
+            m_cellsX = m_width;
+            m_cellsY = m_height;
+            m_active = false;
+        } else {
+            m_cellsX = static_cast<int>(std::max<qint64>(1, static_cast<qint64>(m_width) * maxLongSide / longSide));
+            m_cellsY = static_cast<int>(std::max<qint64>(1, static_cast<qint64>(m_height) * maxLongSide / longSide));
+            m_active = true;
+        }
+        setWindow(0, m_height, static_cast<quint64>(m_width));
+    }
+
+    bool isActive() const
+    {
+        return m_active;
+    }
+
+    quint64 sampleCount() const
+    {
+        return static_cast<quint64>(m_cellsX) * m_cellsY;
+    }
+
+    // first cell row boundary at or after row
+    int alignRow(int row) const
+    {
+        if (!m_active || row <= 0 || row >= m_height) {
+            return std::min(std::max(row, 0), m_height);
+        }
+        return rowStart(cellRowAt(row));
+    }
+
+    // the buffer holds image rows [firstRow, firstRow + rows) with stride pixels per row,
+    // returns the number of samples inside
+    quint64 setWindow(int firstRow, int rows, quint64 stride)
+    {
+        const int cyBegin = cellRowAt(firstRow);
+        const int cyEnd = (firstRow + rows >= m_height) ? m_cellsY : cellRowAt(firstRow + rows);
+        m_windowFirstRow = firstRow;
+        m_windowFirstSample = static_cast<quint64>(cyBegin) * m_cellsX;
+        m_windowSamples = static_cast<quint64>(std::max(0, cyEnd - cyBegin)) * m_cellsX;
+        m_stride = stride;
+        return m_windowSamples;
+    }
+
+    quint64 windowSampleCount() const
+    {
+        return m_windowSamples;
+    }
+
+    // offset in pixels of a sample of the window, from the start of the window's buffer
+    inline quint64 pixelIndex(quint64 sample) const
+    {
+        const quint64 cell = m_windowFirstSample + sample;
+        const quint64 cy = cell / static_cast<quint64>(m_cellsX);
+        const quint64 cx = cell - (cy * m_cellsX);
+
+        quint64 x;
+        quint64 y;
+        pick(cx, cy, x, y);
+        return ((y - m_windowFirstRow) * m_stride) + x;
+    }
+
+    // calls fn(x) for every picked pixel of row y in [xBegin, xEnd), for pixels that
+    // arrive in runs rather than in a buffer
+    template<typename Fn>
+    void forEachPickInRow(quint64 y, quint64 xBegin, quint64 xEnd, Fn &&fn) const
+    {
+        if (xBegin >= xEnd || y >= static_cast<quint64>(m_height)) {
+            return;
+        }
+        const quint64 cy = cellOf(y, m_height, m_cellsY);
+        for (quint64 cx = cellOf(xBegin, m_width, m_cellsX); cx < static_cast<quint64>(m_cellsX) && colStart(cx) < xEnd; cx++) {
+            quint64 px;
+            quint64 py;
+            pick(cx, cy, px, py);
+            if (py == y && px >= xBegin && px < xEnd) {
+                fn(px);
+            }
+        }
+    }
+
+private:
+    inline void pick(quint64 cx, quint64 cy, quint64 &x, quint64 &y) const
+    {
+        const quint64 x0 = colStart(cx);
+        const quint64 y0 = rowStart(cy);
+        const quint64 cw = colStart(cx + 1) - x0;
+        const quint64 ch = rowStart(cy + 1) - y0;
+
+        const quint64 r = counterRandom(m_seed, (cy * m_cellsX) + cx);
+        x = x0 + ((r & 0xFFFFFFFFULL) % cw);
+        y = y0 + ((r >> 32) % ch);
+    }
+
+    // cell holding pixel v along an axis of size pixels split into cells
+    static inline quint64 cellOf(quint64 v, int size, int cells)
+    {
+        return (((v + 1) * cells) - 1) / size;
+    }
+
+    // cell edges are spread evenly so every cell is one or two pixels of the same size apart
+    inline quint64 colStart(quint64 cx) const
+    {
+        return (cx * m_width) / m_cellsX;
+    }
+
+    inline quint64 rowStart(quint64 cy) const
+    {
+        return (cy * m_height) / m_cellsY;
+    }
+
+    // first cell row starting at or after row
+    int cellRowAt(int row) const
+    {
+        if (m_cellsY == 0 || row <= 0) {
+            return 0;
+        }
+        quint64 cy = (static_cast<quint64>(row) * m_cellsY) / m_height;
+        while (cy < static_cast<quint64>(m_cellsY) && rowStart(cy) < static_cast<quint64>(row)) {
+            cy++;
+        }
+        return static_cast<int>(cy);
+    }
+
+    int m_width{0};
+    int m_height{0};
+    int m_cellsX{0};
+    int m_cellsY{0};
+    quint64 m_seed{0};
+    bool m_active{false};
+
+    int m_windowFirstRow{0};
+    quint64 m_windowFirstSample{0};
+    quint64 m_windowSamples{0};
+    quint64 m_stride{0};
+};
+
+#endif // PIXEL_SAMPLER_H
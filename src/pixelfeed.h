@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2023 Rasyuqa Asyira H <qampidh@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ **/
+
+#ifndef PIXELFEED_H
+#define PIXELFEED_H
+
+#include <QtGlobal>
+
+/*
+ * Receiver for decoders that push pixels as they decode them
+ *
+ * begin() is called once before the first pixel with the number of threads
+ * that will call pixels(). Every thread index is only used by one thread at a
+ * time, so receivers can keep per thread state without locking. Pixels come
+ * in runs along a row, in whatever order the decoder finishes them, as
+ * interleaved samples in the format agreed with the decoder. The data is
+ * only valid during the call.
+ */
+class PixelFeed
+{
+public:
+    virtual ~PixelFeed() = default;
+
+    // false aborts the decode
+    virtual bool begin(int threads) = 0;
+
+    virtual void pixels(int thread, quint64 x, quint64 y, quint64 count, const void *data) = 0;
+
+    // decoders may stop early or at least skip the work once this is set
+    virtual bool isCanceled() const
+    {
+        return false;
+    }
+};
+
+#endif // PIXELFEED_H
@@ -77,124 +77,6 @@ struct ImageRGBTyped {
     inline bool operator>=(ImageRGBTyped &rhs) { return !(*this < rhs); }
 };
 
-typedef QPair<ImageXYZDouble, ImageRGBFloat> ColorPoint;
-inline bool operator==(const ColorPoint &lhs, const ColorPoint &rhs) {
-    return (lhs.first.X == rhs.first.X) && (lhs.first.Y == rhs.first.Y) && (lhs.first.Z == rhs.first.Z);
-}
-// inline bool operator<(const ColorPoint &lhs, const ColorPoint &rhs) {
-//     return lhs.second.N < rhs.second.N;
-// }
-// inline bool operator>(const ColorPoint &lhs, const ColorPoint &rhs) { return rhs < lhs; }
-// inline bool operator<=(const ColorPoint &lhs, const ColorPoint &rhs) { return !(lhs > rhs); }
-// inline bool operator>=(const ColorPoint &lhs, const ColorPoint &rhs) { return !(lhs < rhs); }
-
-template<>
-struct std::hash<ColorPoint>
-{
-    inline size_t operator()(const ColorPoint &lhs) const noexcept
-    {
-        // double in = lhs.first.X + (2 * lhs.first.Y) + (3 * lhs.first.Z);
-        // if (std::isnan(in)) return 0;
-        // /*
-        //  *    "You like playing it unsafe"
-        //  *             "Do you?"
-        //  *
-        //  */
-        // return static_cast<size_t>(*reinterpret_cast<uint64_t *>(&in));
-
-        // Thank you SO 664014 & 20511347 for the quick vector hashing function...
-        // This one needed to generate key for unordered_set for fast pixel sorting
-        // during trimming duplicate pixels.
-
-        const float r = lhs.first.X;
-        const float g = lhs.first.Y;
-        const float b = lhs.first.Z;
-
-        std::vector<uint32_t> vec{*reinterpret_cast<const uint32_t *>(&r),
-                                  *reinterpret_cast<const uint32_t *>(&g),
-                                  *reinterpret_cast<const uint32_t *>(&b)};
-        std::size_t seed = vec.size();
-        for(auto x : vec) {
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = (x >> 16) ^ x;
-            seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
-};
-
-template<>
-struct std::hash<ImageRGBFloat>
-{
-    inline size_t operator()(const ImageRGBFloat &lhs) const noexcept
-    {
-        // double in = lhs.R + (2 * lhs.G) + (3 * lhs.B);
-        // return static_cast<size_t>(*reinterpret_cast<uint64_t *>(&in));
-
-        const float r = lhs.R;
-        const float g = lhs.G;
-        const float b = lhs.B;
-
-        std::vector<uint32_t> vec{*reinterpret_cast<const uint32_t *>(&r),
-                                  *reinterpret_cast<const uint32_t *>(&g),
-                                  *reinterpret_cast<const uint32_t *>(&b)};
-        std::size_t seed = vec.size();
-        for(auto x : vec) {
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = ((x >> 16) ^ x) * 0x45d9f3b;
-            x = (x >> 16) ^ x;
-            seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        }
-        return seed;
-    }
-};
-
-template<>
-struct std::hash<ImageXYZDouble>
-{
-    inline size_t operator()(const ImageXYZDouble &lhs) const noexcept
-    {
-        double in = lhs.X + (2 * lhs.Y) + (3 * lhs.Z);
-        return static_cast<size_t>(*reinterpret_cast<uint64_t *>(&in));
-    }
-};
-
-template<typename T>
-struct std::hash<ImageRGBTyped<T>>
-{
-    inline size_t operator()(const ImageRGBTyped<T> &lhs) const noexcept
-    {
-        if constexpr (std::numeric_limits<T>::is_integer) {
-            std::vector<uint32_t>vec{lhs.R, lhs.G, lhs.B};
-            std::size_t seed = vec.size();
-            for(auto x : vec) {
-                x = ((x >> 16) ^ x) * 0x45d9f3b;
-                x = ((x >> 16) ^ x) * 0x45d9f3b;
-                x = (x >> 16) ^ x;
-                seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-            }
-            return seed;
-        } else {
-            const float r = lhs.R;
-            const float g = lhs.G;
-            const float b = lhs.B;
-
-            std::vector<uint32_t> vec{*reinterpret_cast<const uint32_t *>(&r),
-                                      *reinterpret_cast<const uint32_t *>(&g),
-                                      *reinterpret_cast<const uint32_t *>(&b)};
-            std::size_t seed = vec.size();
-            for(auto x : vec) {
-                x = ((x >> 16) ^ x) * 0x45d9f3b;
-                x = ((x >> 16) ^ x) * 0x45d9f3b;
-                x = (x >> 16) ^ x;
-                seed ^= x + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-            }
-            return seed;
-        }
-    }
-};
-
 struct PlotSetting2D {
     bool enableAA{false};
     bool forceBucket{false};
@@ -212,6 +94,14 @@ struct PlotSetting2D {
     int multisample3d{0};
 };
 
+struct PlotSettingParser {
+    int gamutResolution{100};
+    int xyzLatticeSize{0};
+    int floatMantissaBits{-1};
+    // 0 keeps the parser's random seed
+    quint64 trimSeed{0};
+};
+
 struct PlotSetting3D {
     bool useMaxBlend{false};
     bool toggleOpaque{false};
@@ -35,6 +35,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <limits>
 
 #include <lcms2.h>
 
@@ -124,7 +126,7 @@ public:
 
     QMutex m_locker;
 
-    QVector<ColorPoint> *m_cPoints;
+    const ColorPointStore *m_cPoints{nullptr};
     QVector<cmsCIExyY> m_adaptedColorChecker76;
     QVector<cmsCIExyY> m_adaptedColorChecker;
     QVector<cmsCIExyY> m_adaptedColorCheckerNew;
@@ -158,7 +160,7 @@ public:
     QScopedPointer<QAction> forceBucketRendering;
 
     QFutureWatcher<QPair<QImage, QRect>> m_future;
-    QFutureWatcher<QVector<QPair<QVector<ColorPoint *>, QRect>>> m_futureData;
+    QFutureWatcher<QVector<QPair<QVector<int>, QRect>>> m_futureData;
 
     bool enableLabels{true};
     bool enableGrids{true};
@@ -381,7 +383,7 @@ void Scatter2dChart::overrideSettings(PlotSetting2D &plot)
     d->isSettingOverride = true;
 }
 
-void Scatter2dChart::addDataPoints(QVector<ColorPoint> &dArray, int size)
+void Scatter2dChart::addDataPoints(const ColorPointStore &dArray, int size)
 {
     d->needUpdatePixmap = true;
     d->m_neededParticles = dArray.size();
@@ -393,15 +395,17 @@ void Scatter2dChart::addDataPoints(QVector<ColorPoint> &dArray, int size)
 
     d->m_cPoints = &dArray;
 
-    const auto occ = std::max_element(dArray.cbegin(), dArray.cend(), [](const ColorPoint &lhs, const ColorPoint &rhs){
-                        return lhs.second.N < rhs.second.N;
-                    })->second.N;
-    const auto min = std::min_element(dArray.cbegin(), dArray.cend(), [](const ColorPoint &lhs, const ColorPoint &rhs){
-                        return lhs.first.Z < rhs.first.Z;
-                    })->first.Z;
-    const auto max = std::max_element(dArray.cbegin(), dArray.cend(), [](const ColorPoint &lhs, const ColorPoint &rhs){
-                         return lhs.first.Z < rhs.first.Z;
-                     })->first.Z;
+    // plain loops over the count and luminance columns
+    quint32 occ = 0;
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+    const quint32 *counts = dArray.countData();
+    const float *xyY = dArray.xyYData();
+    for (int i = 0; i < dArray.size(); i++) {
+        occ = std::max(occ, counts[i]);
+        min = std::min(min, xyY[(i * 3) + 2]);
+        max = std::max(max, xyY[(i * 3) + 2]);
+    }
 
     d->m_minY = min;
     d->m_maxY = max;
@@ -523,8 +527,8 @@ void Scatter2dChart::drawDataPoints()
     // TODO: kinda spaghetti here...
 
     // internal function for painting the chunks concurrently
-    std::function<QPair<QImage, QRect>(const QPair<QVector<ColorPoint *>, QRect> &)> const paintInChunk =
-        [&](const QPair<QVector<ColorPoint *>, QRect> &chunk) -> QPair<QImage, QRect> {
+    std::function<QPair<QImage, QRect>(const QPair<QVector<int>, QRect> &)> const paintInChunk =
+        [&](const QPair<QVector<int>, QRect> &chunk) -> QPair<QImage, QRect> {
         if (chunk.first.size() == 0) {
             return {QImage(), QRect()};
         }
@@ -565,9 +569,9 @@ void Scatter2dChart::drawDataPoints()
             }
             const QPointF mapped = [&]() {
                 if (offset.isNull()) {
-                    return mapPoint(QPointF(chunk.first.at(i)->first.X, chunk.first.at(i)->first.Y));
+                    return mapPoint(QPointF(d->m_cPoints->x(chunk.first.at(i)), d->m_cPoints->y(chunk.first.at(i))));
                 }
-                return mapPoint(QPointF(chunk.first.at(i)->first.X, chunk.first.at(i)->first.Y)) - offset;
+                return mapPoint(QPointF(d->m_cPoints->x(chunk.first.at(i)), d->m_cPoints->y(chunk.first.at(i)))) - offset;
             }();
 
             const QColor col = [&]() {
@@ -576,13 +580,18 @@ void Scatter2dChart::drawDataPoints()
                 // QColor temp2 = temp.toExtendedRgb();
                 // Oh it seems to be automagically assign to extended rgb
 
+                const PackedColor &pc = d->m_cPoints->color(chunk.first.at(i));
+                const float r = pc.r;
+                const float g = pc.g;
+                const float b = pc.b;
+
                 QColor temp2;
                 if (d->isDownscaled) {
-                    temp2.setRgbF(chunk.first.at(i)->second.R, chunk.first.at(i)->second.G, chunk.first.at(i)->second.B, 0.5);
+                    temp2.setRgbF(r, g, b, 0.5);
                 } else if (d->isTrimmed) {
-                    temp2.setRgbF(chunk.first.at(i)->second.R, chunk.first.at(i)->second.G, chunk.first.at(i)->second.B, std::max(static_cast<double>(chunk.first.at(i)->second.A), d->m_pointOpacity));
+                    temp2.setRgbF(r, g, b, std::max(static_cast<double>(pc.a), d->m_pointOpacity));
                 } else {
-                    temp2.setRgbF(chunk.first.at(i)->second.R, chunk.first.at(i)->second.G, chunk.first.at(i)->second.B, d->m_pointOpacity);
+                    temp2.setRgbF(r, g, b, d->m_pointOpacity);
                 }
 
                 // Clamp to sRGB if not 16bit
@@ -613,15 +622,15 @@ void Scatter2dChart::drawDataPoints()
     }; // paintInChunk
 
     // internal function for adaptive bucket sampling
-    std::function<QVector<QPair<QVector<ColorPoint *>, QRect>>(
-        const QVector<QPair<QVector<ColorPoint *>, QRect>> &)> const bucketDataCalc =
-        [&](const QVector<QPair<QVector<ColorPoint *>, QRect>> &vecIn) -> QVector<QPair<QVector<ColorPoint *>, QRect>> {
+    std::function<QVector<QPair<QVector<int>, QRect>>(
+        const QVector<QPair<QVector<int>, QRect>> &)> const bucketDataCalc =
+        [&](const QVector<QPair<QVector<int>, QRect>> &vecIn) -> QVector<QPair<QVector<int>, QRect>> {
 
         const int pixmapH = d->m_pixmap.height();
         const int pixmapW = d->m_pixmap.width();
         const int bucketPadding = d->m_particleSize;
 
-        QVector<QPair<QVector<ColorPoint *>, QRect>> vecInternal = vecIn;
+        QVector<QPair<QVector<int>, QRect>> vecInternal = vecIn;
         const int subdivideNum = 2;
         const int maxParticle = 100000;
 
@@ -633,7 +642,7 @@ void Scatter2dChart::drawDataPoints()
             bool hasOverparticle = false;
 
             for (int i = 0; i < fragSize; i++) {
-                QVector<QPair<QVector<ColorPoint *>, QRect>> subdivBucketStorage;
+                QVector<QPair<QVector<int>, QRect>> subdivBucketStorage;
                 if (vecInternal.at(i).first.size() > maxParticle) {
                     const int subdivideBucketSize = vecInternal.at(i).second.width() / subdivideNum;
                     const int sdivBuckets = subdivideNum * subdivideNum;
@@ -643,7 +652,7 @@ void Scatter2dChart::drawDataPoints()
                     subdivBucketStorage.clear();
                     subdivBucketStorage.resize(sdivBuckets);
                     for (int pts = 0; pts < vecInternal.at(i).first.size(); pts++) {
-                        const QPointF map = mapPoint(QPointF(vecInternal.at(i).first.at(pts)->first.X, vecInternal.at(i).first.at(pts)->first.Y));
+                        const QPointF map = mapPoint(QPointF(d->m_cPoints->x(vecInternal.at(i).first.at(pts)), d->m_cPoints->y(vecInternal.at(i).first.at(pts))));
                         const auto sdPoints = vecInternal.at(i).first.at(pts);
 
                         if (d->isCancelFired) {
@@ -675,7 +684,7 @@ void Scatter2dChart::drawDataPoints()
 
             vecInternal.erase(std::remove_if(vecInternal.begin(),
                                              vecInternal.end(),
-                                             [](QPair<QVector<ColorPoint *>, QRect> i) {
+                                             [](QPair<QVector<int>, QRect> i) {
                                                  return i.first.isEmpty();
                                              }),
                               vecInternal.end());
@@ -702,8 +711,8 @@ void Scatter2dChart::drawDataPoints()
     const int bucketSize = (d->isDownscaled ? bucketDownscaledSize : bucketDefaultSize);
     const int bucketPadding = d->m_particleSize;
 
-    QVector<QPair<QVector<ColorPoint*>, QRect>> fragmentedColPoints;
-    QVector<ColorPoint*> temporaryColPoints;
+    QVector<QPair<QVector<int>, QRect>> fragmentedColPoints;
+    QVector<int> temporaryColPoints;
 
     const bool needUpdate = (d->isDownscaled || d->inputScatterData || d->renderSlices);
 
@@ -712,8 +721,8 @@ void Scatter2dChart::drawDataPoints()
     if (needUpdate) {
         d->m_neededParticles = 0;
         for (int i = 0; i < d->m_cPoints->size(); i += d->adaptiveIterVal) {
-            if ((d->m_cPoints->at(i).first.X > rb.originX && d->m_cPoints->at(i).first.X < rb.maxX)
-                && (d->m_cPoints->at(i).first.Y > rb.originY && d->m_cPoints->at(i).first.Y < rb.maxY)) {
+            if ((d->m_cPoints->x(i) > rb.originX && d->m_cPoints->x(i) < rb.maxX)
+                && (d->m_cPoints->y(i) > rb.originY && d->m_cPoints->y(i) < rb.maxY)) {
                 d->m_neededParticles++;
             }
         }
@@ -766,7 +775,7 @@ void Scatter2dChart::drawDataPoints()
                     const int orY = h * bucketSize;
 
                     const QRect bucket(orX, orY, bucketSize, bucketSize);
-                    fragmentedColPoints.append(QPair<QVector<ColorPoint *>, QRect>({}, bucket));
+                    fragmentedColPoints.append(QPair<QVector<int>, QRect>({}, bucket));
                 }
             }
         }
@@ -779,14 +788,14 @@ void Scatter2dChart::drawDataPoints()
                 const double currentPos =  d->m_minY + ((d->m_slicePos * 1.0 / d->m_numberOfSlices * 1.0) * sliceRange);
                 const double minY = currentPos - sliceHalfSize;
                 const double maxY = currentPos + sliceHalfSize;
-                if (d->m_cPoints->at(i).first.Z < minY || d->m_cPoints->at(i).first.Z > maxY) {
+                if (d->m_cPoints->luminance(i) < minY || d->m_cPoints->luminance(i) > maxY) {
                     continue;
                 }
             }
 
             // iterate over the buckets for each points
             if (d->useBucketRender) {
-                const QPointF map = mapPoint(QPointF(d->m_cPoints->at(i).first.X, d->m_cPoints->at(i).first.Y));
+                const QPointF map = mapPoint(QPointF(d->m_cPoints->x(i), d->m_cPoints->y(i)));
                 bool isDataWritten = false;
 
                 // iterate over the buckets for each points
@@ -794,7 +803,7 @@ void Scatter2dChart::drawDataPoints()
                     if ((map.x() > fragmentedColPoints[bck].second.left() - bucketPadding && map.x() < (fragmentedColPoints[bck].second.left() + bucketSize) + (bucketPadding * 2))
                         && (map.y() > fragmentedColPoints[bck].second.top() - bucketPadding && map.y() < (fragmentedColPoints[bck].second.top() + bucketSize) + (bucketPadding * 2))
                         && (map.x() > 0 && map.x() < pixmapW) && (map.y() > 0 && map.y() < pixmapH)) {
-                        fragmentedColPoints[bck].first.append(const_cast<ColorPoint *>(&d->m_cPoints->at(i)));
+                        fragmentedColPoints[bck].first.append(i);
                         isDataWritten = true;
                     }
                 }
@@ -805,10 +814,10 @@ void Scatter2dChart::drawDataPoints()
                 }
             } else {
                 // mutipass
-                if ((d->m_cPoints->at(i).first.X > rb.originX && d->m_cPoints->at(i).first.X < rb.maxX)
-                    && (d->m_cPoints->at(i).first.Y > rb.originY && d->m_cPoints->at(i).first.Y < rb.maxY)) {
-                    const QPointF map = mapPoint(QPointF(d->m_cPoints->at(i).first.X, d->m_cPoints->at(i).first.Y));
-                    temporaryColPoints.append(const_cast<ColorPoint *>(&d->m_cPoints->at(i)));
+                if ((d->m_cPoints->x(i) > rb.originX && d->m_cPoints->x(i) < rb.maxX)
+                    && (d->m_cPoints->y(i) > rb.originY && d->m_cPoints->y(i) < rb.maxY)) {
+                    const QPointF map = mapPoint(QPointF(d->m_cPoints->x(i), d->m_cPoints->y(i)));
+                    temporaryColPoints.append(i);
                     d->m_drawnParticles++;
                 }
 
@@ -1854,36 +1863,44 @@ void Scatter2dChart::saveSlicesAsImage()
         const QString outputFile =
             fileNameTrimmed + tr("_") + QString::number(i).rightJustified(4, '0') + tr(".") + finSuffix;
 
-        QImage out(d->m_pixmap);
         if (finSuffix == "jxl") {
 #ifdef HAVE_JPEGXL
-            switch (out.format()) {
-            case QImage::Format_RGBA8888:
-            case QImage::Format_RGBA8888_Premultiplied:
-            case QImage::Format_ARGB32:
-            case QImage::Format_ARGB32_Premultiplied:
-            case QImage::Format_RGBA64:
-            case QImage::Format_RGBA64_Premultiplied:
-                out.convertToColorSpace(QColorSpace::SRgb);
-                break;
+            const QImage &pixmap = d->m_pixmap;
+            const QColorSpace target = [&]() {
+                switch (pixmap.format()) {
 #if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
-            case QImage::Format_RGBA16FPx4:
-            case QImage::Format_RGBA16FPx4_Premultiplied:
-            case QImage::Format_RGBA32FPx4:
-            case QImage::Format_RGBA32FPx4_Premultiplied:
-                out.convertToColorSpace(QColorSpace::SRgbLinear);
-                break;
+                case QImage::Format_RGBA16FPx4:
+                case QImage::Format_RGBA16FPx4_Premultiplied:
+                case QImage::Format_RGBA32FPx4:
+                case QImage::Format_RGBA32FPx4_Premultiplied:
+                    return QColorSpace(QColorSpace::SRgbLinear);
 #endif
-            default:
-                out.convertToColorSpace(QColorSpace::SRgb);
-                break;
-            }
+                default:
+                    return QColorSpace(QColorSpace::SRgb);
+                }
+            }();
+            const QImage::Format format = JxlWriter::encodableFormat(pixmap.format());
 
+            // converted a tile at a time as the encoder asks, the pixmap itself is never copied
             JxlWriter jxlw;
-            jxlw.convert(&out, outputFile, 1);
+            jxlw.convert(
+                pixmap.size(),
+                format,
+                [&](const QRect &rect, uchar *dst, qsizetype stride) {
+                    QImage tile = pixmap.copy(rect);
+                    tile.convertToColorSpace(target);
+                    tile.convertTo(format);
+                    const size_t rowBytes = static_cast<size_t>(rect.width()) * (tile.depth() / 8);
+                    for (int y = 0; y < tile.height(); y++) {
+                        std::memcpy(dst + (stride * y), tile.constScanLine(y), rowBytes);
+                    }
+                    return true;
+                },
+                outputFile,
+                1);
 #endif
         } else {
-            out.save(outputFile, nullptr, 75);
+            d->m_pixmap.save(outputFile, nullptr, 75);
         }
         pDial.setValue(i);
     }
@@ -21,6 +21,7 @@
 #include <QWidget>
 #include <QScopedPointer>
 
+#include "colorpointstore.h"
 #include "plot_typedefs.h"
 
 class Scatter2dChart : public QWidget
@@ -31,7 +32,7 @@ public:
     ~Scatter2dChart();
 
     void overrideSettings(PlotSetting2D &plot);
-    void addDataPoints(QVector<ColorPoint> &dArray, int size = 100);
+    void addDataPoints(const ColorPointStore &dArray, int size = 100);
     void addGamutOutline(QVector<ImageXYZDouble> &dOutGamut, QVector3D &dWhitePoint);
     void addColorSpace(QByteArray &rawICCProfile);
     void resetCamera();
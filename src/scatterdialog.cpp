@@ -5,6 +5,7 @@
  **/
 
 #include "scatterdialog.h"
+#include "gamutcore.h"
 #include "imageparsersc.h"
 #include "scatter2dchart.h"
 #include "custom3dchart.h"
@@ -12,7 +13,6 @@
 #include "./gamutplotterconfig.h"
 
 #ifdef HAVE_JPEGXL
-#include "jxlreader.h"
 #include "jxlwriter.h"
 #endif
 
@@ -23,8 +23,8 @@
 #include <QColorSpace>
 #include <QElapsedTimer>
 #include <QFileDialog>
+#include <QFontMetrics>
 #include <QHBoxLayout>
-#include <QImageReader>
 #include <QIODevice>
 #include <QLabel>
 #include <QMessageBox>
@@ -34,6 +34,7 @@
 #include <QPushButton>
 #include <QScreen>
 #include <QThread>
+#include <QTimer>
 #include <QVBoxLayout>
 #include <QWidget>
 #include <QWindow>
@@ -41,6 +42,66 @@
 #include <QKeyEvent>
 #include <QCloseEvent>
 
+#include <cstring>
+
+// plots this coarse start from the JXL preview and get refined in the background
+static constexpr int draftPlotDensity = 1000;
+
+#ifdef HAVE_JPEGXL
+// converted and labeled a tile at a time as the encoder asks, plot itself is never copied
+static bool savePlotJxl(const QImage &plot, const QString &label, const QString &fileName)
+{
+    const QColorSpace target = [&]() {
+        switch (plot.format()) {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
+        case QImage::Format_RGBA16FPx4:
+        case QImage::Format_RGBA16FPx4_Premultiplied:
+        case QImage::Format_RGBA32FPx4:
+        case QImage::Format_RGBA32FPx4_Premultiplied:
+            return QColorSpace(QColorSpace::SRgbLinear);
+#endif
+        default:
+            return QColorSpace(QColorSpace::SRgb);
+        }
+    }();
+    const QImage::Format format = JxlWriter::encodableFormat(plot.format());
+
+    const QFont labelFont("Courier", 10, QFont::Medium);
+    const int labelFlags = Qt::AlignTop | Qt::AlignHCenter | Qt::TextWordWrap;
+    const QRect labelRect =
+        label.isEmpty() ? QRect() : QFontMetrics(labelFont, &plot).boundingRect(plot.rect(), labelFlags, label);
+
+    JxlWriter jxlw;
+    return jxlw.convert(
+        plot.size(),
+        format,
+        [&](const QRect &rect, uchar *dst, qsizetype stride) {
+            QImage tile = plot.copy(rect);
+            if (tile.colorSpace() != target) {
+                tile.convertToColorSpace(target);
+            }
+            if (labelRect.intersects(rect)) {
+                QPainter pn;
+                if (!pn.begin(&tile)) {
+                    return false;
+                }
+                pn.translate(-rect.topLeft());
+                pn.setPen(QPen(Qt::white));
+                pn.setFont(labelFont);
+                pn.drawText(plot.rect(), labelFlags, label);
+                pn.end();
+            }
+            tile.convertTo(format);
+            const size_t rowBytes = static_cast<size_t>(rect.width()) * (tile.depth() / 8);
+            for (int y = 0; y < tile.height(); y++) {
+                std::memcpy(dst + (stride * y), tile.constScanLine(y), rowBytes);
+            }
+            return true;
+        },
+        fileName);
+}
+#endif
+
 class Q_DECL_HIDDEN ScatterDialog::Private
 {
 public:
@@ -58,8 +119,40 @@ public:
     bool m_overrideSettings{false};
     QSize m_lastSize;
     PlotSetting2D m_plotSetting;
+    PlotSettingParser m_parserSetting;
+    QString m_maxOccString;
+
+    ColorPointStore inputImg;
+
+    // full parse running behind a draft plot
+    bool m_isDraft{false};
+    QScopedPointer<ImageParserSC> m_refineParser;
+    QScopedPointer<QThread> m_refineThread;
+    ColorPointStore refinedImg;
+
+    // the draft and the refine parser get the same options
+    void setupParser(ImageParserSC &parser) const
+    {
+        parser.setGamutResolution(m_parserSetting.gamutResolution);
+        parser.setXyzLatticeSize(m_parserSetting.xyzLatticeSize);
+        parser.setFloatQuantization(m_parserSetting.floatMantissaBits);
+        if (m_parserSetting.trimSeed != 0) {
+            parser.setTrimSeed(m_parserSetting.trimSeed);
+        }
+    }
 
-    QVector<ColorPoint> inputImg;
+    void trimParsed(ImageParserSC &parser) const
+    {
+        if (m_is2d) {
+            parser.trimImage();
+        } else if (m_plotDensity >= 10000) {
+            parser.trimImage(0);
+        } else if (m_plotDensity >= 4000) {
+            parser.trimImage(4000000);
+        } else {
+            parser.trimImage(400000);
+        }
+    }
 };
 
 ScatterDialog::ScatterDialog(QString fName, int plotType, int plotDensity, QWidget *parent)
@@ -84,12 +177,20 @@ ScatterDialog::ScatterDialog(QString fName, int plotType, int plotDensity, QWidg
 ScatterDialog::~ScatterDialog()
 {
     qDebug() << "Plot deleted";
-    // move delete to close event
-    // delete d;
+    // deleted without a close event, the refine thread still works on d
+    if (d && d->m_refineThread) {
+        d->m_refineParser->cancel();
+        d->m_refineThread->wait();
+    }
 }
 
 void ScatterDialog::closeEvent(QCloseEvent *event)
 {
+    // the decoder and the parser both stop at their next chunk, the wait is short
+    if (d->m_refineThread) {
+        d->m_refineParser->cancel();
+        d->m_refineThread->wait();
+    }
     if (d->m_is2d) {
         d->m_2dScatter->cancelRender();
     }
@@ -103,112 +204,107 @@ void ScatterDialog::overrideSettings(const PlotSetting2D &plot)
     d->m_overrideSettings = true;
 }
 
+void ScatterDialog::overrideParserSettings(const PlotSettingParser &parser)
+{
+    d->m_parserSetting = parser;
+}
+
 bool ScatterDialog::startParse()
 {
     imgDetailLbl->setToolTip(QString());
-    QGuiApplication::processEvents();
 
     QElapsedTimer ti;
     ti.start();
 
     const auto st = ti.elapsed();
-    QString maxOccString;
 
     {
         ImageParserSC parsedImgInternal;
+        d->setupParser(parsedImgInternal);
+        QString parseError;
+        const bool isJxlArt = d->m_fName.isEmpty();
+
+        // decoding, parsing and trimming run on their own thread, this one only watches
+        const auto parseJob = [&]() {
+            GamutCore::DecodedImage preview;
+            if (d->m_plotDensity <= draftPlotDensity
+                && GamutCore::decodeImagePreview(d->m_fName, d->m_plotDensity, preview)) {
+                GamutCore::parseImage(parsedImgInternal, preview, d->m_plotDensity, &d->inputImg);
+                d->m_isDraft = true;
+            } else if (!GamutCore::parseImageFile(parsedImgInternal, d->m_fName, d->m_plotDensity, &d->inputImg, &parseError)) {
+                return;
+            }
 
-#ifdef HAVE_JPEGXL
-        QFileInfo fi(d->m_fName);
-        if (fi.suffix() == "jxl" || d->m_fName.isEmpty()) {
-            QProgressDialog pDial;
-            pDial.setRange(0, 0);
-            pDial.setLabelText("Opening image...");
-            pDial.setModal(true);
+            if (d->inputImg.isEmpty() || parsedImgInternal.isCanceled()) {
+                return;
+            }
 
-            pDial.show();
-            QGuiApplication::processEvents();
-            QGuiApplication::processEvents();
+            d->trimParsed(parsedImgInternal);
+        };
 
-            JxlReader jxlfile(d->m_fName);
-            QMessageBox msg;
-            if (!jxlfile.processJxl()) {
-                QMessageBox msg;
-                msg.warning(this, "Warning", "Failed to open JXL file!");
-                pDial.close();
-                return false;
-            }
-            pDial.close();
-            parsedImgInternal.inputFile(jxlfile.getRawImage(),
-                                        jxlfile.getRawICC(),
-                                        jxlfile.getImageColorDepth(),
-                                        jxlfile.getImageDimension(),
-                                        d->m_plotDensity,
-                                        &d->inputImg);
-
-            if (d->m_fName.isEmpty()) {
-                d->m_fName = QString(
-                    "Internally stored JXL art - <a "
-                    "href='https://jxl-art.surma.technology/"
-                    "?zcode="
-                    "C89MKclQMDez4PJIzUzPKAEzg5xDFAwNuPyLMlPzShJLMvPzFAy5nDJLUlILgIqBMqEFxYm5BTmpCkZcwYWlqalVqVxcmWkKyQ"
-                    "p2QIUKCroK4Qq6IAZQLFzbT9cvHChhAOSDpPwUdC3gbFegaQZcAA'>[source in jxl-art.surma.technology]</a>");
-                imgDetailLbl->setToolTip(
-                    QString("Link will open: "
-                            "https://jxl-art.surma.technology/"
-                            "?zcode="
-                            "C89MKclQMDez4PJIzUzPKAEzg5xDFAwNuPyLMlPzShJLMvPzFAy5nDJLUlILgIqBMqEFxYm5BTmpCkZcwYWlqalVqV"
-                            "xcmWkKyQp2QIUKCroK4Qq6IAZQLFzbT9cvHChhAOSDpPwUdC3gbFegaQZcAA"));
-            }
-        } else {
+        {
             QProgressDialog pDial;
-            pDial.setRange(0, 0);
-            pDial.setLabelText("Opening image...");
             pDial.setModal(true);
+            pDial.setAutoReset(false);
+            pDial.setRange(0, 0);
+            pDial.setLabelText(ImageParserSC::stageName(ImageParserSC::ParseIdle));
+            pDial.setCancelButtonText("Stop");
+
+            QScopedPointer<QThread> parseThread(QThread::create(parseJob));
+            QTimer pollTimer;
+
+            connect(parseThread.data(), &QThread::finished, &pDial, &QProgressDialog::reset);
+            connect(&pDial, &QProgressDialog::canceled, [&]() {
+                parsedImgInternal.cancel();
+            });
+            connect(&pollTimer, &QTimer::timeout, [&]() {
+                const ProgressToken &progress = parsedImgInternal.progress();
+                const int stage = progress.stage.load(std::memory_order_acquire);
+                const quint64 maximum = progress.maximum.load(std::memory_order_relaxed);
+                const quint64 value = progress.value.load(std::memory_order_relaxed);
+
+                pDial.setLabelText(ImageParserSC::stageName(stage));
+                if (maximum == 0) {
+                    pDial.setRange(0, 0);
+                } else {
+                    pDial.setRange(0, 1000);
+                    pDial.setValue(static_cast<int>(std::min<quint64>(1000, (value * 1000) / maximum)));
+                }
+            });
 
-            pDial.show();
-            QGuiApplication::processEvents();
-            QGuiApplication::processEvents();
+            parseThread->start();
+            pollTimer.start(100);
 
-#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
-            QImageReader::setAllocationLimit(512);
-#endif
-            QImageReader reader(d->m_fName);
-            const QImage imgs = reader.read();
-            if (imgs.isNull()) {
-                QMessageBox msg;
-                msg.warning(this, "Warning", "Invalid or unsupported image format!");
-                pDial.close();
-                return false;
-            }
-            pDial.close();
-            parsedImgInternal.inputFile(imgs, d->m_plotDensity, &d->inputImg);
+            pDial.exec();
+            parseThread->wait();
         }
-#else
-        QProgressDialog pDial;
-        pDial.setRange(0, 0);
-        pDial.setLabelText("Opening image...");
-        pDial.setModal(true);
 
-        pDial.show();
-        QGuiApplication::processEvents();
-        QGuiApplication::processEvents();
-
-#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
-        QImageReader::setAllocationLimit(512);
-#endif
-        QImageReader reader(d->m_fName);
-        const QImage imgs = reader.read();
-        if (imgs.isNull()) {
+        if (!parseError.isEmpty()) {
             QMessageBox msg;
-            msg.warning(this, "Warning", "Invalid or unsupported image format!");
-            pDial.close();
+            msg.warning(this, "Warning", parseError);
             return false;
         }
-        pDial.close();
-        parsedImgInternal.inputFile(imgs, d->m_plotDensity, &d->inputImg);
+
+#ifdef HAVE_JPEGXL
+        if (isJxlArt) {
+            d->m_fName = QString(
+                "Internally stored JXL art - <a "
+                "href='https://jxl-art.surma.technology/"
+                "?zcode="
+                "C89MKclQMDez4PJIzUzPKAEzg5xDFAwNuPyLMlPzShJLMvPzFAy5nDJLUlILgIqBMqEFxYm5BTmpCkZcwYWlqalVqVxcmWkKyQ"
+                "p2QIUKCroK4Qq6IAZQLFzbT9cvHChhAOSDpPwUdC3gbFegaQZcAA'>[source in jxl-art.surma.technology]</a>");
+            imgDetailLbl->setToolTip(
+                QString("Link will open: "
+                        "https://jxl-art.surma.technology/"
+                        "?zcode="
+                        "C89MKclQMDez4PJIzUzPKAEzg5xDFAwNuPyLMlPzShJLMvPzFAy5nDJLUlILgIqBMqEFxYm5BTmpCkZcwYWlqalVqV"
+                        "xcmWkKyQp2QIUKCroK4Qq6IAZQLFzbT9cvHChhAOSDpPwUdC3gbFegaQZcAA"));
+        }
+#else
+        Q_UNUSED(isJxlArt)
 #endif
 
-        if (d->inputImg.isEmpty()) {
+        if (d->inputImg.isEmpty() || parsedImgInternal.isCanceled()) {
             return false;
         }
 
@@ -217,7 +313,6 @@ bool ScatterDialog::startParse()
         d->m_wtpt = parsedImgInternal.getWhitePointXYY();
 
         if (d->m_is2d) {
-            parsedImgInternal.trimImage();
             d->m_2dScatter.reset(new Scatter2dChart(layout()->widget()));
             if (d->m_overrideSettings) {
                 d->m_2dScatter->overrideSettings(d->m_plotSetting);
@@ -233,13 +328,6 @@ bool ScatterDialog::startParse()
 
         if (!d->m_is2d) {
             rstViewBtn->setVisible(false);
-            if (d->m_plotDensity >= 10000) {
-                parsedImgInternal.trimImage(0);
-            } else if (d->m_plotDensity >= 4000) {
-                parsedImgInternal.trimImage(4000000);
-            } else {
-                parsedImgInternal.trimImage(400000);
-            }
             d->m_custom3d.reset(new Custom3dChart(d->m_plotSetting, layout()->widget()));
             d->m_custom3d->addDataPoints(d->inputImg, d->m_wtpt, outGamut);
             if (!d->m_custom3d->checkValidity()) {
@@ -251,7 +339,7 @@ bool ScatterDialog::startParse()
             layout()->replaceWidget(container, d->m_custom3d.get());
             d->m_custom3d->setFocus();
         }
-        maxOccString = parsedImgInternal.getMaxOccurence();
+        d->m_maxOccString = parsedImgInternal.getMaxOccurence();
     }
 
     const auto ed = ti.elapsed();
@@ -266,21 +354,7 @@ bool ScatterDialog::startParse()
         rstViewBtn->setText(QStringLiteral("Reset view"));
     }
 
-    const QString imLabel = [&]() {
-        QString tmp = "<b>File name:</b> " + d->m_fName + "<br><b>Profile name:</b> ";
-        if (!d->m_profileName.isEmpty()) {
-            tmp += d->m_profileName;
-        } else {
-            tmp += "None (Assumed as sRGB)";
-        }
-        tmp += " | <b>Profile white:</b> ";
-        const QVector3D wtpt = d->m_wtpt;
-        tmp += "x: " + QString::number(wtpt.x()) + " | y: " + QString::number(wtpt.y());
-        tmp += "<br><b>Color statistics:</b> " + maxOccString;
-        return tmp;
-    }();
-
-    imgDetailLbl->setText(imLabel);
+    updateDetailLabel();
 
     connect(saveImageBtn, &QPushButton::clicked, this, &ScatterDialog::savePlotImage);
     connect(rstWindowBtn, &QPushButton::clicked, this, &ScatterDialog::resetWinDimension);
@@ -292,9 +366,95 @@ bool ScatterDialog::startParse()
     layout()->setContentsMargins(9, 9, 9, 9);
     resize(QSize(screenSize.height() / 1.3, screenSize.height() / 1.25));
 
+    if (d->m_isDraft) {
+        startRefine();
+    }
+
     return true;
 }
 
+void ScatterDialog::updateDetailLabel()
+{
+    QString tmp = "<b>File name:</b> " + d->m_fName + "<br><b>Profile name:</b> ";
+    if (!d->m_profileName.isEmpty()) {
+        tmp += d->m_profileName;
+    } else {
+        tmp += "None (Assumed as sRGB)";
+    }
+    tmp += " | <b>Profile white:</b> ";
+    const QVector3D wtpt = d->m_wtpt;
+    tmp += "x: " + QString::number(wtpt.x()) + " | y: " + QString::number(wtpt.y());
+    tmp += "<br><b>Color statistics:</b> " + d->m_maxOccString;
+    if (d->m_isDraft) {
+        tmp += " <i>(draft from the preview, refining...)</i>";
+    }
+
+    imgDetailLbl->setText(tmp);
+}
+
+void ScatterDialog::startRefine()
+{
+    d->m_refineParser.reset(new ImageParserSC);
+    d->setupParser(*d->m_refineParser);
+
+    const QString fName = d->m_fName;
+    const int density = d->m_plotDensity;
+    Private *const p = d.data();
+    d->m_refineThread.reset(QThread::create([p, fName, density]() {
+        if (!GamutCore::parseImageFile(*p->m_refineParser, fName, density, &p->refinedImg)) {
+            p->refinedImg.clear();
+            return;
+        }
+        if (p->refinedImg.isEmpty() || p->m_refineParser->isCanceled()) {
+            return;
+        }
+        p->trimParsed(*p->m_refineParser);
+    }));
+
+    // queued, finished comes from the refine thread
+    connect(d->m_refineThread.data(), &QThread::finished, this, &ScatterDialog::applyRefined);
+    d->m_refineThread->start(QThread::LowPriority);
+}
+
+void ScatterDialog::applyRefined()
+{
+    // closed while refining
+    if (!d || !d->m_refineThread) {
+        return;
+    }
+    d->m_refineThread->wait();
+
+    const bool canceled = d->m_refineParser->isCanceled();
+    if (!canceled && !d->refinedImg.isEmpty()) {
+        QVector<ImageXYZDouble> outGamut = *d->m_refineParser->getOuterGamut();
+
+        if (d->m_is2d) {
+            // the chart renders straight from the store, stop it before swapping
+            d->m_2dScatter->cancelRender();
+            d->inputImg.swap(d->refinedImg);
+            d->m_2dScatter->addDataPoints(d->inputImg, 2);
+            d->m_2dScatter->update();
+        } else {
+            // the points live in GL buffers now, build a new chart around the full set
+            QScopedPointer<Custom3dChart> refined(new Custom3dChart(d->m_plotSetting, layout()->widget()));
+            refined->addDataPoints(d->refinedImg, d->m_wtpt, outGamut);
+            if (refined->checkValidity()) {
+                layout()->replaceWidget(d->m_custom3d.get(), refined.get());
+                d->m_custom3d.swap(refined);
+                d->m_custom3d->setFocus();
+            }
+        }
+        d->m_maxOccString = d->m_refineParser->getMaxOccurence();
+    }
+    d->refinedImg.clear();
+
+    d->m_isDraft = false;
+    updateDetailLabel();
+
+    d->m_refineThread.reset();
+    d->m_refineParser.reset();
+}
+
 void ScatterDialog::resetWinDimension()
 {
     QSize screenSize = screen()->size();
@@ -336,9 +496,13 @@ void ScatterDialog::savePlotImage()
         chTitle += "None (Assumed as sRGB)";
     }
 
+    const bool isJxl = tmpFileName.endsWith(".jxl");
+
     QImage out;
 
     if (!d->m_is2d) {
+        // read back from the GL framebuffer on this thread, so it can't be pulled
+        // in tiles from the encoder threads like the 2D plot
         out = d->m_custom3d->takeTheShot();
 #if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
         if (tmpFileName.endsWith(".tif")) {
@@ -355,6 +519,7 @@ void ScatterDialog::savePlotImage()
 #endif
     } else {
         if (d->m_2dScatter->getFullPixmap()) {
+            // shared with the chart, JXL only reads from it
             out = *d->m_2dScatter->getFullPixmap();
 #if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
             if (tmpFileName.endsWith(".tif")) {
@@ -369,35 +534,13 @@ void ScatterDialog::savePlotImage()
                 out.convertTo(QImage::Format_RGBA64);
             }
 #endif
-            if (tmpFileName.endsWith(".jxl")) {
-                switch (out.format()) {
-                case QImage::Format_RGBA8888:
-                case QImage::Format_RGBA8888_Premultiplied:
-                case QImage::Format_ARGB32:
-                case QImage::Format_ARGB32_Premultiplied:
-                case QImage::Format_RGBA64:
-                case QImage::Format_RGBA64_Premultiplied:
-                    out.convertToColorSpace(QColorSpace::SRgb);
-                    break;
-#if QT_VERSION >= QT_VERSION_CHECK(6, 2, 0)
-                case QImage::Format_RGBA16FPx4:
-                case QImage::Format_RGBA16FPx4_Premultiplied:
-                case QImage::Format_RGBA32FPx4:
-                case QImage::Format_RGBA32FPx4_Premultiplied:
-                    out.convertToColorSpace(QColorSpace::SRgbLinear);
-                    break;
-#endif
-                default:
-                    out.convertToColorSpace(QColorSpace::SRgb);
-                    break;
-                }
-            }
         }
     }
 
     Q_ASSERT(!out.isNull());
 
-    if (useLabel == QMessageBox::Yes) {
+    // JXL draws the label into its tiles
+    if (useLabel == QMessageBox::Yes && !isJxl) {
         QPainter pn;
         if (!pn.begin(&out)) {
             return;
@@ -416,10 +559,9 @@ void ScatterDialog::savePlotImage()
     QGuiApplication::processEvents();
     QGuiApplication::processEvents();
 
-    if (tmpFileName.endsWith(".jxl")) {
+    if (isJxl) {
 #ifdef HAVE_JPEGXL
-        JxlWriter jxlw;
-        if (jxlw.convert(&out, tmpFileName)) {
+        if (savePlotJxl(out, (useLabel == QMessageBox::Yes) ? chTitle : QString(), tmpFileName)) {
             pre.close();
             QGuiApplication::processEvents();
             QMessageBox msg;
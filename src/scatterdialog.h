@@ -22,6 +22,7 @@ public:
 
     bool startParse();
     void overrideSettings(const PlotSetting2D &plot);
+    void overrideParserSettings(const PlotSettingParser &parser);
 
     void savePlotImage();
     void resetWinDimension();
@@ -33,6 +34,10 @@ protected:
     bool event(QEvent *event) override;
 
 private:
+    void startRefine();
+    void applyRefined();
+    void updateDetailLabel();
+
     class Private;
     QScopedPointer<Private> d;
 };